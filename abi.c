@@ -0,0 +1,87 @@
+// SPDX-FileCopyrightText: 2022-present Jakub Jirutka <jakub@jirutka.cz>
+// SPDX-License-Identifier: GPL-2.0-or-later
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "abi.h"
+#include "core.h"
+
+static uint64_t soname_hash (const char *name, size_t len) {
+	uint64_t hash = fnv1a(name, len, FNV1A_INIT);
+
+	return hash ? hash : 1;  // 0 marks an empty slot
+}
+
+static struct abi_slot *find_slot (struct abi_slot *slots, size_t cap, uint64_t hash) {
+	size_t i = hash & (cap - 1);
+
+	while (slots[i].name && slots[i].name != hash) {
+		i = (i + 1) & (cap - 1);
+	}
+	return &slots[i];
+}
+
+static int grow (struct abi_index *index) {
+	size_t cap = index->cap ? index->cap * 2 : 256;
+	struct abi_slot *slots = calloc(cap, sizeof(*slots));
+	if (!slots) {
+		return -1;
+	}
+	for (size_t i = 0; i < index->cap; i++) {
+		if (index->slots[i].name) {
+			*find_slot(slots, cap, index->slots[i].name) = index->slots[i];
+		}
+	}
+	free(index->slots);
+	index->slots = slots;
+	index->cap = cap;
+
+	return 0;
+}
+
+int abi_add_dependency (struct abi_index *index, const char *name, size_t len) {
+	// Keep the load factor under 1/2.
+	if (index->num * 2 >= index->cap && grow(index) < 0) {
+		return -1;
+	}
+	uint64_t hash = soname_hash(name, len);
+	struct abi_slot *slot = find_slot(index->slots, index->cap, hash);
+
+	if (!slot->name) {
+		slot->name = hash;
+		index->num++;
+	}
+	slot->dependents++;
+
+	return 0;
+}
+
+uint32_t abi_dependents (const struct abi_index *index, const char *name, size_t len) {
+	if (index->cap == 0) {
+		return 0;
+	}
+	return find_slot(index->slots, index->cap, soname_hash(name, len))->dependents;
+}
+
+void abi_free (struct abi_index *index) {
+	free(index->slots);
+	*index = (struct abi_index) {0};
+}
+
+int abi_add_removed (struct upgrade *dest, const struct abi_index *index, const char *name) {
+	size_t old_len = dest->abi_removed ? strlen(dest->abi_removed) : 0;
+
+	char *removed = realloc(dest->abi_removed, old_len + strlen(name) + 2);
+	if (!removed) {
+		return -1;
+	}
+	sprintf(removed + old_len, "%s%s", old_len > 0 ? " " : "", name);
+	dest->abi_removed = removed;
+	dest->abi_dependents += abi_dependents(index, name, strlen(name));
+
+	return 0;
+}
@@ -0,0 +1,44 @@
+// SPDX-FileCopyrightText: 2022-present Jakub Jirutka <jakub@jirutka.cz>
+// SPDX-License-Identifier: GPL-2.0-or-later
+//
+// Prediction of ABI breakage by upgrades. Shared libraries are provided as
+// "so:" names (e.g. so:libssl.so.3); if the new version of a package no
+// longer provides a so: name that the old one did, installed packages
+// depending on it may break or need a rebuild. The index maps every so: name
+// the installed packages depend on to the number of such packages.
+#ifndef ABI_H
+#define ABI_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "core.h"
+
+struct abi_slot {
+	uint64_t name;  // hash of the so: name, 0 is empty
+	uint32_t dependents;
+};
+
+struct abi_index {
+	struct abi_slot *slots;  // open addressing
+	size_t num, cap;
+};
+
+static inline bool abi_is_soname (const char *name) {
+	return strncmp(name, "so:", 3) == 0;
+}
+
+// Records an installed package depending on the so: name.
+int abi_add_dependency (struct abi_index *index, const char *name, size_t len);
+
+// Returns the number of installed packages depending on the so: name.
+uint32_t abi_dependents (const struct abi_index *index, const char *name, size_t len);
+
+void abi_free (struct abi_index *index);
+
+// Records a so: name that the upgrade drops into dest (see struct upgrade).
+int abi_add_removed (struct upgrade *dest, const struct abi_index *index, const char *name);
+
+#endif
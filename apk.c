@@ -1,48 +1,122 @@
 // SPDX-FileCopyrightText: 2022-present Jakub Jirutka <jakub@jirutka.cz>
 // SPDX-License-Identifier: GPL-2.0-or-later
+#define _POSIX_C_SOURCE 200809L
 
-#include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
-#include <unistd.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <time.h>
 
-#include <apk/apk_blob.h>
-#include <apk/apk_database.h>
-#include <apk/apk_defines.h>
-#include <apk/apk_package.h>
-#include <apk/apk_print.h>
-#include <apk/apk_solver.h>
-
-#include <json.h>  // json-c
 #include <daemon/plugin.h>  // collectd
 
-#define PLUGIN_NAME "apk"
-
-#ifndef PLUGIN_VERSION
-  #define PLUGIN_VERSION "0.2.0"
-#endif
-
-#define OS_RELEASE_PATH "/etc/os-release"
+#include "core.h"
+#include "lazy.h"
+#include "rcu.h"
+#include "scheduler.h"
+#include "share.h"
+#include "trigger.h"
 
 #define LOG_PREFIX PLUGIN_NAME " plugin: "
 
-#define log_info(...) INFO(LOG_PREFIX __VA_ARGS__)
-#define log_warn(...) WARNING(LOG_PREFIX __VA_ARGS__)
-#define log_err(...) ERROR(LOG_PREFIX __VA_ARGS__)
-
-#ifndef min
-  #define min(a, b) ((a) < (b) ? (a) : (b))
-#endif
+// Settings that can be changed without a restart (see ReloadFile).
+struct settings {
+	double min_interval;  // 0 means the plugin's Interval
+	double max_interval;  // 0 means the same as min_interval (not adaptive)
+	double solve_budget;  // in milliseconds, 0 for unlimited
+	int timeout;  // in seconds, 0 for apk's default
+	int top_n;  // packages and origins by installed size, 0 to disable
+	double cache_max_size;  // of CacheDir in MiB, 0 for unlimited
+	double pressure_threshold;  // PSI avg10 in percent, 0 to ignore pressure
+	double max_postpone;  // in seconds
+	bool allow_untrusted;
+	bool reuse_result;  // of the previous refresh if nothing relevant changed
+	char **repositories;  // NULL for etc/apk/repositories
+	size_t repositories_num;
+};
 
-#define UNUSED __attribute__((unused))
+static struct {
+	char *root_dir;
+	char *cache_dir;
+	char *trigger_fifo;
+	char *snapshot_file;
+	char *reload_file;
+	char *share_address;  // NULL for any
+	int share_port;  // 0 to not share the cached indexes
+	char **peers;  // base URLs, e.g. http://10.0.0.2:8091
+	size_t peers_num;
+	bool snapshot_disabled;  // SnapshotFile ""
+	double trigger_debounce;
+	struct settings base;  // from the Plugin block
+} config = {
+	.trigger_debounce = 2.0,
+	.base.top_n = 10,
+	.base.max_postpone = 3600,
+	.base.reuse_result = true,
+};
 
-extern unsigned int apk_flags;
-extern int apk_verbosity;
+#define DEFAULT_SNAPSHOT_FILE "/var/lib/collectd/" PLUGIN_NAME ".snapshot"
+
+static struct sched sched;
+static struct trigger *trigger = NULL;
+static struct share *share = NULL;
+
+// The last successfully collected report (or the one loaded from the
+// snapshot), re-dispatched between refreshes. It's published as an immutable
+// struct report, so reads never wait for a refresh running in the trigger or
+// warm-up thread.
+static struct rcu_cell result;
+
+// Only the thread that has set refreshing may run a refresh and touch sched.
+static bool refreshing = false;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t refreshed = PTHREAD_COND_INITIALIZER;
+
+// Learned cost of the solver and modes of the last (up to 32) refreshes for
+// the degradation rate. Like sched, owned by the thread that set refreshing.
+static struct solve_model solve_model;
+static uint32_t degraded_bits = 0;
+static unsigned refreshes_num = 0;
+
+// Totals of the cache and peer statistics of all refreshes since the root's
+// architecture was last seen to change. Like sched, owned by the thread that
+// set refreshing.
+static char totals_arch[64];
+static struct cache_stats cache_totals;
+static uint64_t peer_fetches = 0;  // refreshes that got the indexes from a peer
+static uint64_t peer_failures = 0;  // peers tried that didn't have all of them
+
+// The last pressure read by under_pressure(). Like sched, owned by the thread
+// that set refreshing.
+static struct pressure pressure;
+static bool pressure_known = false;
+static bool pressure_missing = false;  // PSI not available, already logged
+
+// The base settings with those from ReloadFile applied. Like sched, owned by
+// the thread that set refreshing.
+static struct settings settings;
+static struct timespec reload_mtime;  // of ReloadFile, 0 if it doesn't exist
+static double default_interval;  // the plugin's Interval
+
+// Loaded on the first refresh (see lazy.h). Every report comes from it, so
+// it's loaded whenever there's a report to free or save.
+static const struct core_ops *core = NULL;
+
+static pthread_t warmup_thread;
+static bool warmup_started = false;
+
+static void log_msg (int level, const char *msg) {
+	plugin_log(level, LOG_PREFIX "%s", msg);
+}
 
-// Override function from libapk defined in src/print.c.
-void apk_log (const char UNUSED *_prefix, const char *format, ...) {
+void core_log (int level, const char *format, ...) {
 	va_list ap;
 	va_start(ap, format);
 
@@ -50,200 +124,778 @@ void apk_log (const char UNUSED *_prefix, const char *format, ...) {
 	vsnprintf(msg, sizeof(msg), format, ap);
 	va_end(ap);
 
-	log_info("%s", msg);
+	log_msg(level, msg);
 }
 
-// Override function from libapk defined in src/print.c.
-void apk_log_err (const char *prefix, const char *format, ...) {
-	va_list ap;
-	va_start(ap, format);
+static int dispatch_gauge (const char *plugin_instance, const char *type,
+                           const char *type_instance, gauge_t value, meta_data_t *meta) {
+	value_list_t vl = {
+		.plugin = PLUGIN_NAME,
+		.values = &(value_t){ .gauge = value },
+		.values_len = 1,
+		.meta = meta,
+	};
+	strncpy(vl.plugin_instance, plugin_instance, sizeof(vl.plugin_instance));
+	strncpy(vl.type, type, sizeof(vl.type));
+	if (type_instance) {
+		strncpy(vl.type_instance, type_instance, sizeof(vl.type_instance));
+	}
 
-	char msg[1024];
-	vsnprintf(msg, sizeof(msg), format, ap);
-	va_end(ap);
+	return plugin_dispatch_values(&vl);
+}
 
-	if (strcmp("ERROR: ", prefix) == 0) {
-		log_err("%s", msg);
-	} else {
-		log_warn("%s", msg);
+static int dispatch_derive (const char *plugin_instance, const char *type,
+                            const char *type_instance, derive_t value) {
+	value_list_t vl = {
+		.plugin = PLUGIN_NAME,
+		.values = &(value_t){ .derive = value },
+		.values_len = 1,
+	};
+	strncpy(vl.plugin_instance, plugin_instance, sizeof(vl.plugin_instance));
+	strncpy(vl.type, type, sizeof(vl.type));
+	strncpy(vl.type_instance, type_instance, sizeof(vl.type_instance));
+
+	return plugin_dispatch_values(&vl);
+}
+
+// Dispatches the entries as bytes-<kind>-<rank>, so the series stay the
+// same when the ranking changes; the name is in the metadata.
+static void dispatch_footprint (const char *kind, const struct footprint_entry *entries, size_t num) {
+	for (size_t i = 0; i < num; i++) {
+		char type_instance[DATA_MAX_NAME_LEN];
+		snprintf(type_instance, sizeof(type_instance), "%s-%02zu", kind, i + 1);
+
+		meta_data_t *meta = meta_data_create();
+		meta_data_add_string(meta, "name", entries[i].name);
+		dispatch_gauge("footprint", "bytes", type_instance, entries[i].size, meta);
+		meta_data_destroy(meta);
 	}
 }
 
-// This is a very simplified implementation, it does not support escaping
-// (`"behold \"x\" var"`) nor doubled quote character (`"dont ""do this"`).
-static int parse_enclosed_word (char *dest, const char *str, size_t max_len) {
-	size_t len = 0;
-	const char *end = NULL;
+static int dispatch_report (const struct report *report) {
+	int rc = -1;
+
+	profile_phase("metadata");
+	meta_data_t *meta = meta_data_create();
 
-	// /^"([^"]*)".*/ or /^'([^']*)'.*/
-	if (str[0] == '"' || str[0] == '\'') {
-		if (!(end = strchr(str + 1, str[0]))) {
-			return -1;
+	if (meta_data_add_string(meta, "packages", report->packages_json) < 0) {
+		log_err("failed to add value metadata");
+		goto done;
+	}
+	meta_data_add_string(meta, "os-id", report->os.id);
+	meta_data_add_string(meta, "os-version", report->os.version_id);
+	meta_data_add_string(meta, "arch", report->arch);
+	// Seconds since the result was collected; it may come from the snapshot
+	// of the previous run, or be reused by the adaptive scheduler.
+	meta_data_add_signed_int(meta, "age", time(NULL) - report->time);
+	meta_data_add_string(meta, "mode", report_mode_name(report->mode));
+
+	log_info("metadata: os-id = \"%s\", os-version = \"%s\", packages = %s",
+	         report->os.id, report->os.version_id, report->packages_json);
+
+	profile_phase("dispatch");
+	dispatch_gauge("upgradable", "count", NULL, report->upgrades_num, meta);
+
+	// Of the last refresh: packages changed in the indexes since the one
+	// before, and whether the solver had to run. There's none yet when the
+	// result comes from the snapshot.
+	if (report->mode != REPORT_RESTORED) {
+		dispatch_gauge("index", "count", "changed", report->index_changed, NULL);
+		dispatch_gauge("index", "boolean", "full_solve", report->mode == REPORT_SOLVED, NULL);
+	}
+	if (report->digest.entries_num > 0) {
+		dispatch_gauge("index", "bytes", "index_digest", report->digest_bytes, NULL);
+	}
+
+	if (report->health.known) {
+		dispatch_gauge("database", "count", "broken_files", report->health.broken_files, NULL);
+		dispatch_gauge("database", "count", "broken_scripts", report->health.broken_scripts, NULL);
+		dispatch_gauge("database", "count", "broken_xattrs", report->health.broken_xattrs, NULL);
+		dispatch_gauge("database", "count", "missing_world", report->health.missing_world, NULL);
+	}
+	for (size_t i = 0; i < report->tags_num; i++) {
+		char plugin_instance[DATA_MAX_NAME_LEN];
+		snprintf(plugin_instance, sizeof(plugin_instance), "tag-%s", report->tags[i].name);
+
+		dispatch_gauge(plugin_instance, "count", "installed", report->tags[i].installed, NULL);
+		dispatch_gauge(plugin_instance, "count", "upgradable", report->tags[i].upgradable, NULL);
+	}
+	dispatch_footprint("package", report->footprint.packages, report->footprint.packages_num);
+	dispatch_footprint("origin", report->footprint.origins, report->footprint.origins_num);
+
+	rc = 0;
+done:
+	meta_data_destroy(meta);
+
+	return rc;
+}
+
+// Dispatches the cache and peer statistics as <kind>-<arch>, so instances
+// monitoring roots of different architectures report them separately.
+// Must be called between begin_refresh() and end_refresh().
+static void dispatch_arch_stats (void) {
+	char cache_instance[DATA_MAX_NAME_LEN], peer_instance[DATA_MAX_NAME_LEN];
+
+	if (!*totals_arch) {
+		return;  // no refresh yet
+	}
+	snprintf(cache_instance, sizeof(cache_instance), "cache-%s", totals_arch);
+	snprintf(peer_instance, sizeof(peer_instance), "peer-%s", totals_arch);
+
+	if (config.cache_dir) {
+		dispatch_derive(cache_instance, "cache_result", "hit", cache_totals.hits);
+		dispatch_derive(cache_instance, "cache_result", "miss", cache_totals.misses);
+		dispatch_derive(cache_instance, "cache_result", "evicted", cache_totals.evictions);
+		if (cache_totals.bytes > 0) {
+			dispatch_gauge(cache_instance, "bytes", NULL, cache_totals.bytes, NULL);
 		}
-		len = end - ++str;
-	// /^([^ \t\r\n;]*).*/
-	} else {
-		len = strcspn(str, " \t\r\n;");
 	}
-	strncpy(dest, str, min(len, max_len));
+	if (config.peers_num > 0) {
+		dispatch_derive(peer_instance, "operations", "fetched", peer_fetches);
+		dispatch_derive(peer_instance, "operations", "failed", peer_failures);
+	}
+	if (share) {
+		dispatch_derive(peer_instance, "operations", "served", share_served(share));
+	}
+}
 
-	return len;
+static double monotonic_now (void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
 }
 
-struct os_release {
-	char id[64];
-	char version_id[64];
-};
+static void report_destroy (void *data) {
+	core->report_free(data);
+	free(data);
+}
+
+// Publishes a copy of report (shallow, it takes ownership of its contents).
+static int publish_report (const struct report *report) {
+	struct report *copy = malloc(sizeof(*copy));
+	if (!copy) {
+		return -1;
+	}
+	*copy = *report;
+
+	if (rcu_publish(&result, copy, report_destroy) < 0) {
+		free(copy);
+		return -1;
+	}
+	return 0;
+}
+
+static int load_snapshot (struct report *dest, const char *path) {
+	FILE *fp = fopen(path, "rb");
+	if (!fp) {
+		return -1;
+	}
+	int rc = core->read_snapshot(dest, fp);
+	fclose(fp);
+
+	return rc;
+}
+
+// Writes the snapshot into a temporary file and renames it over the old one,
+// so a crash never leaves a truncated snapshot behind.
+static int save_snapshot (const struct report *report, const char *path) {
+	char tmp_path[4096];
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+	FILE *fp = fopen(tmp_path, "wb");
+	if (!fp) {
+		return -1;
+	}
+	int rc = core->write_snapshot(report, fp);
+	if (fclose(fp) != 0 || rc < 0 || rename(tmp_path, path) < 0) {
+		remove(tmp_path);
+		return -1;
+	}
+	return 0;
+}
 
-static int read_os_release (struct os_release *dest) {
-	FILE *fp = NULL;
+static int get_number (const oconfig_item_t *ci, double *dest, bool positive) {
+	double value = 0;
+
+	if (cf_util_get_double(ci, &value) != 0 || value < 0 || (positive && value == 0)) {
+		log_err("invalid value of %s", ci->key);
+		return -1;
+	}
+	*dest = value;
+	return 0;
+}
 
-	if (!(fp = fopen(OS_RELEASE_PATH, "r"))) {
+static int add_urls (char ***dest, size_t *dest_num, const oconfig_item_t *ci) {
+	if (ci->values_num < 1) {
+		log_err("%s requires at least one URL", ci->key);
 		return -1;
 	}
+	for (int i = 0; i < ci->values_num; i++) {
+		if (ci->values[i].type != OCONFIG_TYPE_STRING) {
+			log_err("invalid value of %s", ci->key);
+			return -1;
+		}
+		char **urls = realloc(*dest, (*dest_num + 1) * sizeof(char *));
+		if (!urls) {
+			return -1;
+		}
+		*dest = urls;
+		if (!(urls[*dest_num] = strdup(ci->values[i].value.string))) {
+			return -1;
+		}
+		(*dest_num)++;
+	}
+	return 0;
+}
+
+// Parses ci into dest. Returns 1 if ci is not a setting that can be reloaded,
+// -1 if its value is invalid, 0 otherwise.
+static int parse_setting (struct settings *dest, const oconfig_item_t *ci) {
+	if (strcasecmp(ci->key, "MinInterval") == 0) {
+		return get_number(ci, &dest->min_interval, true);
+
+	} else if (strcasecmp(ci->key, "MaxInterval") == 0) {
+		return get_number(ci, &dest->max_interval, true);
 
-	char line[128] = {0};
-	while (fgets(line, sizeof(line), fp)) {
-		char key[16] = {0};
-		int pos = 0;
-		if (sscanf(line, " %15[A-Za-z0-9_]=%n", key, &pos) < 1) {
-		//                ^ ^-- this MUST match sizeof(key) - 1
-		//                `---- allow zero or more whitespace chars at the beginning
-			continue;
+	} else if (strcasecmp(ci->key, "SolveBudget") == 0) {
+		return get_number(ci, &dest->solve_budget, false);
+
+	} else if (strcasecmp(ci->key, "Timeout") == 0) {
+		if (cf_util_get_int(ci, &dest->timeout) != 0 || dest->timeout < 0) {
+			log_err("invalid value of %s", ci->key);
+			return -1;
 		}
-		char *rest = line + pos;
+		return 0;
 
-		if (strcmp(key, "ID") == 0) {
-			parse_enclosed_word(dest->id, rest, sizeof(dest->id));
-		} else if (strcmp(key, "VERSION_ID") == 0) {
-			parse_enclosed_word(dest->version_id, rest, sizeof(dest->version_id));
+	} else if (strcasecmp(ci->key, "TopN") == 0) {
+		if (cf_util_get_int(ci, &dest->top_n) != 0 || dest->top_n < 0) {
+			log_err("invalid value of %s", ci->key);
+			return -1;
 		}
+		return 0;
+
+	} else if (strcasecmp(ci->key, "CacheMaxSize") == 0) {
+		return get_number(ci, &dest->cache_max_size, false);
 
+	} else if (strcasecmp(ci->key, "PressureThreshold") == 0) {
+		return get_number(ci, &dest->pressure_threshold, false);
+
+	} else if (strcasecmp(ci->key, "MaxPostpone") == 0) {
+		return get_number(ci, &dest->max_postpone, false);
+
+	} else if (strcasecmp(ci->key, "AllowUntrusted") == 0) {
+		return cf_util_get_boolean(ci, &dest->allow_untrusted) == 0 ? 0 : -1;
+
+	} else if (strcasecmp(ci->key, "ReuseResult") == 0) {
+		return cf_util_get_boolean(ci, &dest->reuse_result) == 0 ? 0 : -1;
+
+	} else if (strcasecmp(ci->key, "Repository") == 0) {
+		return add_urls(&dest->repositories, &dest->repositories_num, ci);
 	}
-	fclose(fp);
+	return 1;
+}
+
+static void clear_repositories (struct settings *settings) {
+	for (size_t i = 0; i < settings->repositories_num; i++) {
+		free(settings->repositories[i]);
+	}
+	free(settings->repositories);
+	settings->repositories = NULL;
+	settings->repositories_num = 0;
+}
+
+static void settings_free (struct settings *settings) {
+	clear_repositories(settings);
+	*settings = (struct settings) {0};
+}
+
+static int settings_copy (struct settings *dest, const struct settings *src) {
+	*dest = *src;
+	dest->repositories = NULL;
+	dest->repositories_num = 0;
 
+	if (src->repositories) {
+		if (!(dest->repositories = calloc(src->repositories_num, sizeof(char *)))) {
+			return -1;
+		}
+		for (size_t i = 0; i < src->repositories_num; i++, dest->repositories_num++) {
+			if (!(dest->repositories[i] = strdup(src->repositories[i]))) {
+				settings_free(dest);
+				return -1;
+			}
+		}
+	}
 	return 0;
 }
 
-static int dispatch_gauge (const char *plugin_instance, const char *type,
-                           gauge_t value, meta_data_t *meta) {
-	value_list_t vl = {
-		.plugin = PLUGIN_NAME,
-		.values = &(value_t){ .gauge = value },
-		.values_len = 1,
-		.meta = meta,
-	};
-	strncpy(vl.plugin_instance, plugin_instance, sizeof(vl.plugin_instance));
-	strncpy(vl.type, type, sizeof(vl.type));
+static double effective_min_interval (void) {
+	return settings.min_interval > 0 ? settings.min_interval : default_interval;
+}
 
-	return plugin_dispatch_values(&vl);
+// Re-reads ReloadFile if its mtime has changed (or force is true) and
+// replaces the settings with the base ones overridden by those in the file.
+// The loaded result, the cost model and the scheduler's state are kept. If
+// the file is invalid, the current settings stay in effect. Must be called
+// between begin_refresh() and end_refresh().
+static void reload_settings (bool force) {
+	struct timespec mtime = {0};
+	struct stat st;
+
+	if (!config.reload_file) {
+		return;
+	}
+	if (stat(config.reload_file, &st) == 0) {
+		mtime = st.st_mtim;
+	}
+	if (!force && mtime.tv_sec == reload_mtime.tv_sec && mtime.tv_nsec == reload_mtime.tv_nsec) {
+		return;
+	}
+	reload_mtime = mtime;
+
+	struct settings next = {0};
+	if (settings_copy(&next, &config.base) < 0) {
+		return;
+	}
+	if (mtime.tv_sec != 0 || mtime.tv_nsec != 0) {
+		oconfig_item_t *root = oconfig_parse_file(config.reload_file);
+		if (!root) {
+			log_err("failed to parse %s, keeping the current settings", config.reload_file);
+			goto fail;
+		}
+		int rc = 0;
+		bool repositories = false;
+		for (int i = 0; i < root->children_num && rc == 0; i++) {
+			const oconfig_item_t *child = &root->children[i];
+
+			// Repositories in the file replace the base ones.
+			if (!repositories && strcasecmp(child->key, "Repository") == 0) {
+				clear_repositories(&next);
+				repositories = true;
+			}
+			if ((rc = parse_setting(&next, child)) > 0) {
+				log_err("%s in %s can't be changed without restart", child->key, config.reload_file);
+			}
+		}
+		oconfig_free(root);
+		if (rc != 0) {
+			log_err("invalid %s, keeping the current settings", config.reload_file);
+			goto fail;
+		}
+	}
+	settings_free(&settings);
+	settings = next;
+	sched_set_intervals(&sched, effective_min_interval(), settings.max_interval);
+	log_info("settings reloaded from %s", config.reload_file);
+
+	return;
+fail:
+	settings_free(&next);
+}
+
+// Claims the right to refresh; returns false if another thread is refreshing.
+static bool begin_refresh (void) {
+	pthread_mutex_lock(&lock);
+	bool claimed = !refreshing;
+	refreshing = true;
+	pthread_mutex_unlock(&lock);
+
+	return claimed;
+}
+
+static void end_refresh (void) {
+	pthread_mutex_lock(&lock);
+	refreshing = false;
+	pthread_cond_broadcast(&refreshed);
+	pthread_mutex_unlock(&lock);
+}
+
+// Must be called between begin_refresh() and end_refresh().
+static bool load_core (void) {
+	return core || (core = core_load(log_msg));
 }
 
-static json_object *apk_change_to_json (struct apk_change *change) {
-	const struct apk_package *old_pkg = change->old_pkg,
-	                         *new_pkg = change->new_pkg;
+static bool has_result (void) {
+	struct rcu_obj *obj = rcu_acquire(&result);
+	rcu_release(obj);
+
+	return obj != NULL;
+}
 
-	assert(old_pkg && "change.old_pkg is NULL");
-	assert(old_pkg->name && "change.old_pkg.name is NULL");
-	assert(new_pkg && "change.new_pkg is NULL");
+// Returns true if the CPU, memory or I/O pressure exceeds PressureThreshold.
+// Must be called between begin_refresh() and end_refresh().
+static bool under_pressure (void) {
+	pressure_known = settings.pressure_threshold > 0 && read_pressure(&pressure) == 0;
 
-	char *pkgname = old_pkg->name->name;
-	char *origin = apk_blob_cstr(*old_pkg->origin);
-	char *old_ver = apk_blob_cstr(*old_pkg->version);
-	char *new_ver = apk_blob_cstr(*new_pkg->version);
+	if (settings.pressure_threshold > 0 && !pressure_known && !pressure_missing) {
+		log_warn("failed to read /proc/pressure, ignoring PressureThreshold");
+	}
+	pressure_missing = settings.pressure_threshold > 0 && !pressure_known;
 
-	json_object *obj = json_object_new_object();
-	json_object_object_add(obj, "p", json_object_new_string(pkgname));
-	json_object_object_add(obj, "o", json_object_new_string(origin));
-	json_object_object_add(obj, "v", json_object_new_string(old_ver));
-	json_object_object_add(obj, "w", json_object_new_string(new_ver));
+	if (!pressure_known) {
+		return false;
+	}
+	return max(pressure.cpu, max(pressure.memory, pressure.io)) > settings.pressure_threshold;
+}
 
-	free(old_ver);
-	free(new_ver);
-	free(origin);
+// Returns true if the refresh due now should be postponed because of
+// pressure. There must be a result to dispatch meanwhile. Must be called
+// between begin_refresh() and end_refresh().
+static bool postpone_refresh (void) {
+	bool postponed_before = sched.postponed_since > 0;
 
-	return obj;
+	if (!has_result() || !sched_postpone(&sched, monotonic_now(), under_pressure(), settings.max_postpone)) {
+		return false;
+	}
+	if (!postponed_before) {
+		log_info("postponing refresh, pressure is cpu %.1f%%, memory %.1f%%, io %.1f%%",
+		         pressure.cpu, pressure.memory, pressure.io);
+	}
+	return true;
 }
 
-static int find_upgradable_pkgs (struct apk_database *db, json_object *array) {
-	assert(db && db->open_complete);
-	assert(json_object_is_type(array, json_type_array));
+// Must be called between begin_refresh() and end_refresh(). If offline is
+// true and CacheDir is set, the indexes are not fetched, only the cached ones
+// are used.
+static int refresh (uint64_t local_fingerprint, bool offline) {
+	if (!load_core()) {
+		return -1;
+	}
+	struct core_options opts = {
+		.root_dir = config.root_dir,
+		.cache_dir = config.cache_dir,
+		.cache_max_bytes = settings.cache_max_size * 1024 * 1024,
+		.peers = config.peers,
+		.peers_num = config.peers_num,
+		.allow_untrusted = settings.allow_untrusted,
+		.offline = offline && config.cache_dir,
+		.solve_budget_ms = settings.solve_budget,
+		.timeout = settings.timeout,
+		.repositories = settings.repositories,
+		.repositories_num = settings.repositories_num,
+		.top_n = settings.top_n,
+		.model = &solve_model,
+	};
+	struct report report = {0};
+
+	// The previous result stays valid while we hold the reference.
+	struct rcu_obj *prev = rcu_acquire(&result);
+	int rc = core->collect(&report, &opts, prev && settings.reuse_result ? prev->data : NULL);
+	rcu_release(prev);
 
-	struct apk_changeset changeset = {0};
-	if (apk_solver_solve(db, APK_SOLVERF_UPGRADE, db->world, &changeset) != 0) {
+	if (rc < 0) {
 		return -1;
 	}
+	degraded_bits = degraded_bits << 1 | (report.mode == REPORT_COMPARED);
+	refreshes_num = min(refreshes_num + 1, 32);
 
-	struct apk_change *change;
-	foreach_array_item(change, changeset.changes) {
-		if (change->old_pkg != change->new_pkg) {
-			json_object_array_add(array, apk_change_to_json(change));
-		}
+	if (strcmp(totals_arch, report.arch) != 0) {
+		snprintf(totals_arch, sizeof(totals_arch), "%s", report.arch);
+		cache_totals = (struct cache_stats) {0};
+		peer_fetches = peer_failures = 0;
+	}
+	cache_totals.hits += report.cache.hits;
+	cache_totals.misses += report.cache.misses;
+	cache_totals.evictions += report.cache.evictions;
+	cache_totals.bytes = report.cache.bytes;
+	peer_fetches += report.from_peer;
+	peer_failures += report.peer_failures;
+
+	sched_refreshed(&sched, monotonic_now(), local_fingerprint, report.index_fingerprint,
+	                fnv1a(report.packages_json, strlen(report.packages_json), FNV1A_INIT));
+
+	if (config.snapshot_file && save_snapshot(&report, config.snapshot_file) < 0) {
+		log_warn("failed to write snapshot %s: %s", config.snapshot_file, strerror(errno));
 	}
-	apk_change_array_free(&changeset.changes);
 
+	profile_phase("cleanup");
+	if (publish_report(&report) < 0) {
+		core->report_free(&report);
+		return -1;
+	}
 	return 0;
 }
 
-static int apk_upgradable_read (void) {
-	int rc = -1;
+static int dispatch_last_report (void) {
+	struct rcu_obj *obj = rcu_acquire(&result);
 
-	json_object *pkgs = json_object_new_array();
-	meta_data_t *meta = meta_data_create();
+	if (!obj) {
+		// Nothing to dispatch yet, so wait for the refresh running in another
+		// thread rather than skipping this read.
+		pthread_mutex_lock(&lock);
+		while (refreshing && !(obj = rcu_acquire(&result))) {
+			pthread_cond_wait(&refreshed, &lock);
+		}
+		pthread_mutex_unlock(&lock);
+	}
+	if (!obj) {
+		return -1;
+	}
+	int rc = dispatch_report(obj->data);
+	rcu_release(obj);
 
-	struct apk_db_options db_opts = {0};
-	list_init(&db_opts.repository_list);
-	db_opts.open_flags = APK_OPENF_READ | APK_OPENF_NO_AUTOUPDATE;
+	return rc;
+}
 
-	struct apk_database db;
-	apk_db_init(&db);
+static int apk_upgradable_read (user_data_t UNUSED *ud) {
+	uint64_t local_fingerprint = local_db_fingerprint(config.root_dir);
 
-	int r = 0;
-	if ((r = apk_db_open(&db, &db_opts)) != 0) {
-		log_err("failed to open apk database: %s", apk_error_str(r));
-		goto done;
+	// If another thread is refreshing, just dispatch the last report.
+	if (begin_refresh()) {
+		reload_settings(false);
+		if (sched_due(&sched, monotonic_now(), local_fingerprint) && !postpone_refresh()) {
+			refresh(local_fingerprint, false);
+		}
+		dispatch_gauge("scheduler", "duration", NULL, sched.interval, NULL);
+		if (settings.pressure_threshold > 0) {
+			dispatch_derive("scheduler", "operations", "postponed", sched.postponed_num);
+		}
+		if (pressure_known) {
+			dispatch_gauge("pressure", "percent", "cpu", pressure.cpu, NULL);
+			dispatch_gauge("pressure", "percent", "memory", pressure.memory, NULL);
+			dispatch_gauge("pressure", "percent", "io", pressure.io, NULL);
+		}
+		if (refreshes_num > 0) {
+			dispatch_gauge("solver", "percent", "degraded",
+			               100.0 * __builtin_popcount(degraded_bits) / refreshes_num, NULL);
+		}
+		dispatch_arch_stats();
+		end_refresh();
 	}
+	int rc = dispatch_last_report();
+	profile_phase("other");
 
-	if (find_upgradable_pkgs(&db, pkgs) < 0) {
-		log_err("failed to find upgradable packages, apk solver returned errors");
-		goto done;
+	return rc;
+}
+
+// Called from the trigger thread after a local apk transaction (via the
+// commit hook); re-solves against the cached indexes and dispatches right
+// away instead of waiting for the next read interval.
+static void on_trigger (const char *command, void UNUSED *arg) {
+	if (strcmp(command, "reload") == 0) {
+		// If a refresh is running, the next read reloads the file if changed.
+		if (begin_refresh()) {
+			reload_settings(true);
+			end_refresh();
+		}
+		return;
 	}
+	if (strcmp(command, "refresh") != 0) {
+		log_warn("unknown trigger command: %s", command);
+		return;
+	}
+	log_info("refresh triggered");
 
-	const char *pkgs_json = json_object_to_json_string_ext(pkgs, JSON_C_TO_STRING_PLAIN);
-	if (meta_data_add_string(meta, "packages", pkgs_json) < 0) {
-		log_err("failed to add value metadata");
-		goto done;
+	uint64_t local_fingerprint = local_db_fingerprint(config.root_dir);
+
+	// If a refresh is already running, the next read will catch the change of
+	// the local database via sched_due().
+	if (!begin_refresh()) {
+		return;
 	}
+	// If postponed, the next read will catch the change via sched_due().
+	int rc = postpone_refresh() ? -1 : refresh(local_fingerprint, true);
+	end_refresh();
 
-	struct os_release os = { "", "" };
-	if (read_os_release(&os) < 0) {
-		log_warn("failed to read " OS_RELEASE_PATH ": %s", strerror(errno));
+	if (rc == 0) {
+		dispatch_last_report();
 	}
-	meta_data_add_string(meta, "os-id", os.id);
-	meta_data_add_string(meta, "os-version", os.version_id);
+}
 
-	log_info("metadata: os-id = \"%s\", os-version = \"%s\", packages = %s",
-	         os.id, os.version_id, pkgs_json);
+// Dispatches the result from the snapshot, if any. Must be called between
+// begin_refresh() and end_refresh().
+static void restore_snapshot (void) {
+	struct report report = {0};
 
-	dispatch_gauge("upgradable", "count", json_object_array_length(pkgs), meta);
+	if (!config.snapshot_file || !load_core() || load_snapshot(&report, config.snapshot_file) < 0) {
+		return;
+	}
+	log_info("loaded result from %s, %lld seconds old", config.snapshot_file,
+	         (long long) (time(NULL) - report.time));
 
-	rc = 0;
-done:
-	if (db.open_complete) {
-		apk_db_close(&db);
+	if (publish_report(&report) < 0) {
+		core->report_free(&report);
+	} else {
+		dispatch_last_report();
 	}
-	meta_data_destroy(meta);
-	json_object_put(pkgs);
+}
 
-	return rc;
+// Runs in the background right after init, so neither loading apk-core.so
+// nor the first refresh delays the collectd startup. The snapshot (if any)
+// is dispatched first and replaced by a fresh result as soon as possible.
+static void *warmup_run (void UNUSED *arg) {
+	uint64_t local_fingerprint = local_db_fingerprint(config.root_dir);
+
+	restore_snapshot();
+
+	// If postponed, the snapshot is dispatched until a read refreshes.
+	int rc = postpone_refresh() ? -1 : refresh(local_fingerprint, false);
+	end_refresh();
+
+	if (rc == 0) {
+		dispatch_last_report();
+	}
+	return NULL;
+}
+
+static void warm_start (void) {
+	begin_refresh();  // nobody else is running yet
+	if (pthread_create(&warmup_thread, NULL, warmup_run, NULL) != 0) {
+		log_warn("failed to start background refresh, the first read will do it");
+		end_refresh();
+		return;
+	}
+	warmup_started = true;
+}
+
+// Opens the cached index whose URL without the scheme is path. Only the
+// files named by libapk for the configured repositories are served; those
+// fetched from a peer have been renamed to them, see adopt_peer_indexes().
+// Called from the share thread.
+static int open_shared_index (const char *path, void UNUSED *arg) {
+	struct rcu_obj *obj = rcu_acquire(&result);
+	const struct report *report = obj ? obj->data : NULL;
+	int fd = -1;
+
+	for (size_t i = 0; report && i < report->cached_num && fd < 0; i++) {
+		const struct cached_index *index = &report->cached[i];
+		const char *url = strstr(index->url, "://");
+
+		if (index->available && url && strcmp(url + 3, path) == 0) {
+			char file[4096];
+			snprintf(file, sizeof(file), "%s/%s/%s", config.cache_dir, report->arch, index->file);
+			fd = open(file, O_RDONLY | O_CLOEXEC);
+		}
+	}
+	rcu_release(obj);
+
+	return fd;
+}
+
+static int apk_init (void) {
+	default_interval = CDTIME_T_TO_DOUBLE(plugin_get_interval());
+
+	if (settings_copy(&settings, &config.base) < 0) {
+		return -1;
+	}
+	sched_init(&sched, effective_min_interval(), settings.max_interval);
+	reload_settings(false);  // no refresh is running yet
+
+	if (sched.max_interval > sched.min_interval) {
+		log_info("adaptive refresh interval between %.0f and %.0f seconds",
+		         sched.min_interval, sched.max_interval);
+	}
+	if (config.trigger_fifo) {
+		if (trigger_start(&trigger, config.trigger_fifo, config.trigger_debounce, on_trigger, NULL) < 0) {
+			log_err("failed to start trigger on %s", config.trigger_fifo);
+			return -1;
+		}
+		log_info("listening for triggers on %s", config.trigger_fifo);
+	}
+	if (config.share_port > 0) {
+		if (!config.cache_dir || config.peers_num == 0) {
+			log_err("SharePort requires CacheDir and at least one Peer");
+			return -1;
+		}
+		char port[16];
+		snprintf(port, sizeof(port), "%d", config.share_port);
+		if (share_start(&share, config.share_address, port, config.peers, config.peers_num,
+		                 open_shared_index, NULL) < 0) {
+			return -1;
+		}
+		log_info("sharing cached indexes on port %s", port);
+	}
+	if (!config.snapshot_file && !config.snapshot_disabled) {
+		config.snapshot_file = strdup(DEFAULT_SNAPSHOT_FILE);
+	}
+	warm_start();
+
+	return plugin_register_complex_read(NULL, PLUGIN_NAME, apk_upgradable_read,
+	                                    DOUBLE_TO_CDTIME_T(sched.period), NULL);
+}
+
+static int apk_shutdown (void) {
+	if (trigger) {
+		trigger_stop(trigger);
+		trigger = NULL;
+	}
+	if (share) {
+		share_stop(share);
+		share = NULL;
+	}
+	if (warmup_started) {
+		pthread_join(warmup_thread, NULL);
+		warmup_started = false;
+	}
+	struct rcu_obj *obj = rcu_acquire(&result);
+	if (obj && config.snapshot_file && save_snapshot(obj->data, config.snapshot_file) < 0) {
+		log_warn("failed to write snapshot %s: %s", config.snapshot_file, strerror(errno));
+	}
+	rcu_release(obj);
+	rcu_publish(&result, NULL, NULL);
+
+	return 0;
+}
+
+static int apk_config (oconfig_item_t *ci) {
+	for (int i = 0; i < ci->children_num; i++) {
+		const oconfig_item_t *child = &ci->children[i];
+		const char *key = child->key;
+
+		int rc = parse_setting(&config.base, child);
+		if (rc <= 0) {
+			// a setting that can be reloaded, see parse_setting()
+
+		} else if (strcasecmp(key, "RootDir") == 0) {
+			rc = cf_util_get_string(child, &config.root_dir);
+
+		} else if (strcasecmp(key, "CacheDir") == 0) {
+			rc = cf_util_get_string(child, &config.cache_dir);
+
+		} else if (strcasecmp(key, "TriggerFifo") == 0) {
+			rc = cf_util_get_string(child, &config.trigger_fifo);
+
+		} else if (strcasecmp(key, "ReloadFile") == 0) {
+			rc = cf_util_get_string(child, &config.reload_file);
+
+		} else if (strcasecmp(key, "SnapshotFile") == 0) {
+			if ((rc = cf_util_get_string(child, &config.snapshot_file)) == 0 && *config.snapshot_file == '\0') {
+				free(config.snapshot_file);
+				config.snapshot_file = NULL;
+				config.snapshot_disabled = true;
+			}
+		} else if (strcasecmp(key, "TriggerDebounce") == 0) {
+			rc = get_number(child, &config.trigger_debounce, false);
+
+		} else if (strcasecmp(key, "Peer") == 0) {
+			rc = add_urls(&config.peers, &config.peers_num, child);
+
+		} else if (strcasecmp(key, "ShareAddress") == 0) {
+			rc = cf_util_get_string(child, &config.share_address);
+
+		} else if (strcasecmp(key, "SharePort") == 0) {
+			if ((rc = cf_util_get_int(child, &config.share_port)) == 0
+					&& (config.share_port < 1 || config.share_port > 65535)) {
+				log_err("invalid value of %s", key);
+				rc = -1;
+			}
+
+		} else {
+			log_err("unknown config option: %s", key);
+			rc = -1;
+		}
+		if (rc != 0) {
+			return -1;
+		}
+	}
+	return 0;
 }
 
 // cppcheck-suppress unusedFunction
 void module_register (void) {
-	// Cached APKINDEXes may be outdated and we would need root privileges to
-	// update them, so better to always fetch fresh APKINDEXes in-memory.
-	apk_flags = APK_NO_CACHE | APK_SIMULATE;
-
 	INFO("registering plugin " PLUGIN_NAME " " PLUGIN_VERSION);
-	plugin_register_read(PLUGIN_NAME, apk_upgradable_read);
+	rcu_init(&result);
+	plugin_register_complex_config(PLUGIN_NAME, apk_config);
+	plugin_register_init(PLUGIN_NAME, apk_init);
+	plugin_register_shutdown(PLUGIN_NAME, apk_shutdown);
 }
@@ -0,0 +1,61 @@
+// SPDX-FileCopyrightText: 2022-present Jakub Jirutka <jakub@jirutka.cz>
+// SPDX-License-Identifier: GPL-2.0-or-later
+//
+// Interface to the package database and solver, implemented on top of
+// libapk 2.x in backend_apk2.c.
+#ifndef BACKEND_H
+#define BACKEND_H
+
+#include "core.h"
+
+struct backend_db;
+
+// Name of the linked backend, e.g. "apk2".
+extern const char *const backend_name;
+
+// Opens the apk database (installed packages, world and repository indexes).
+// Returns 0 on success, or -1 on error (the error is logged).
+int backend_open (struct backend_db **dest, const struct core_options *opts);
+
+// Fills dest->digest with the digest of the loaded indexes and the installed
+// closure (see delta.h), and dest->index_fingerprint. Returns 0 on success,
+// or -1 on error.
+int backend_index_digest (struct backend_db *db, struct report *dest);
+
+// Runs the solver in upgrade mode and adds every upgradable package to
+// dest->upgrades. Returns 0 on success, or -1 on error.
+int backend_find_upgrades (struct backend_db *db, struct report *dest);
+
+// Counts the installed packages and dest's upgrades per repository tag the
+// installed package is pinned to into dest->tags.
+void backend_tag_stats (struct backend_db *db, struct report *dest);
+
+// Fills dest from the state flags of the installed packages and the world.
+void backend_db_health (struct backend_db *db, struct db_health *dest);
+
+// Adds the installed packages to dest and finishes it (see footprint.h).
+// Returns 0 on success, or -1 on error.
+int backend_footprint (struct backend_db *db, struct footprint *dest);
+
+// Cheap alternative to backend_find_upgrades(): adds every installed package
+// for which the repositories have a package of the same name with a higher
+// version, ignoring dependencies, pinning and providers. Returns 0 on
+// success, or -1 on error.
+int backend_compare_versions (struct backend_db *db, struct report *dest);
+
+// Sets dest to the indexes of the remote repositories in use and the files
+// in the cache directory holding them. Returns their number, or -1 on error.
+// Free them with cached_indexes_free().
+int backend_cached_indexes (struct backend_db *db, struct cached_index **dest);
+
+// Returns the number of repositories whose index failed to update or load.
+size_t backend_unavailable_repos (struct backend_db *db);
+
+// Writes the name of the file in the cache directory that libapk keeps the
+// index of the repository url (without a tag) in into dest. Returns 0 on
+// success, or -1 if dest is too small.
+int backend_cache_file (const char *url, char *dest, size_t size);
+
+void backend_close (struct backend_db *db);
+
+#endif
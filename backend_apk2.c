@@ -0,0 +1,464 @@
+// SPDX-FileCopyrightText: 2022-present Jakub Jirutka <jakub@jirutka.cz>
+// SPDX-License-Identifier: GPL-2.0-or-later
+//
+// Backend for libapk 2.x.
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <apk/apk_blob.h>
+#include <apk/apk_database.h>
+#include <apk/apk_defines.h>
+#include <apk/apk_io.h>
+#include <apk/apk_package.h>
+#include <apk/apk_print.h>
+#include <apk/apk_solver.h>
+
+#include "backend.h"
+#include "core.h"
+#include "abi.h"
+#include "delta.h"
+
+extern unsigned int apk_flags;
+extern int apk_verbosity;
+
+// Timeout of fetching in seconds that apk(8) sets unless --timeout is given.
+#define APK_DEFAULT_TIMEOUT 60
+
+struct backend_db {
+	struct apk_database db;
+	struct apk_repository_list *repos;  // referenced from apk_db_options
+};
+
+const char *const backend_name = "apk2";
+
+// Override function from libapk defined in src/print.c.
+void apk_log (const char UNUSED *_prefix, const char *format, ...) {
+	va_list ap;
+	va_start(ap, format);
+
+	char msg[1024];
+	vsnprintf(msg, sizeof(msg), format, ap);
+	va_end(ap);
+
+	log_info("%s", msg);
+}
+
+// Override function from libapk defined in src/print.c.
+void apk_log_err (const char *prefix, const char *format, ...) {
+	va_list ap;
+	va_start(ap, format);
+
+	char msg[1024];
+	vsnprintf(msg, sizeof(msg), format, ap);
+	va_end(ap);
+
+	if (strcmp("ERROR: ", prefix) == 0) {
+		log_err("%s", msg);
+	} else {
+		log_warn("%s", msg);
+	}
+}
+
+int backend_open (struct backend_db **dest, const struct core_options *opts) {
+	struct backend_db *bdb = calloc(1, sizeof(*bdb));
+	if (!bdb) {
+		return -1;
+	}
+
+	struct apk_db_options db_opts = {0};
+	list_init(&db_opts.repository_list);
+	db_opts.open_flags = APK_OPENF_READ | APK_OPENF_NO_AUTOUPDATE;
+	db_opts.root = opts->root_dir;
+
+	if (opts->cache_dir) {
+		// Our own cache: an online open refreshes it, an offline open solves
+		// against the cached indexes without touching the network. libapk
+		// doesn't download into the cache in simulate mode.
+		db_opts.cache_dir = opts->cache_dir;
+		if (opts->offline) {
+			apk_flags = APK_SIMULATE;
+		} else {
+			apk_flags = APK_UPDATE_CACHE;
+			db_opts.open_flags = APK_OPENF_READ | APK_OPENF_CACHE_WRITE;
+		}
+	} else {
+		// The system's cached APKINDEXes may be outdated and we would need root
+		// privileges to update them, so better to always fetch fresh
+		// APKINDEXes in-memory.
+		apk_flags = APK_NO_CACHE | APK_SIMULATE;
+	}
+	if (opts->allow_untrusted) {
+		apk_flags |= APK_ALLOW_UNTRUSTED;
+	}
+	// The timeout is global in libapk, so it must be set on every open for
+	// a reload back to the default to take effect.
+	apk_io_url_set_timeout(opts->timeout > 0 ? opts->timeout : APK_DEFAULT_TIMEOUT);
+	if (opts->repositories) {
+		if (!(bdb->repos = calloc(opts->repositories_num, sizeof(*bdb->repos))) && opts->repositories_num > 0) {
+			free(bdb);
+			return -1;
+		}
+		db_opts.open_flags |= APK_OPENF_NO_SYS_REPOS;
+		for (size_t i = 0; i < opts->repositories_num; i++) {
+			bdb->repos[i].url = opts->repositories[i];
+			list_add_tail(&bdb->repos[i].list, &db_opts.repository_list);
+		}
+	}
+
+	apk_db_init(&bdb->db);
+
+	int r = 0;
+	if ((r = apk_db_open(&bdb->db, &db_opts)) != 0) {
+		log_err("failed to open apk database: %s", apk_error_str(r));
+		backend_close(bdb);
+		return -1;
+	}
+	*dest = bdb;
+
+	return 0;
+}
+
+// Hashes URL and description (e.g. "v3.16.2-143-g2ba4f4bf84") of every
+// repository; the description changes with every update of the index.
+static uint64_t index_fingerprint (const struct apk_database *db) {
+	uint64_t hash = FNV1A_INIT;
+
+	for (unsigned i = 0; i < db->num_repos; i++) {
+		const struct apk_repository *repo = &db->repos[i];
+		if (repo->url) {
+			hash = fnv1a(repo->url, strlen(repo->url), hash);
+		}
+		hash = fnv1a(repo->description.ptr, repo->description.len, hash);
+	}
+	return hash;
+}
+
+// Adds installed packages, their dependencies and world to the closure.
+static int digest_local (const struct apk_database *db, struct index_digest *digest) {
+	const struct apk_installed_package *ipkg;
+	const struct apk_dependency *dep;
+	char buf[512];
+
+	list_for_each_entry(ipkg, &db->installed.packages, installed_pkgs_list) {
+		const struct apk_package *pkg = ipkg->pkg;
+		const char *name = pkg->name->name;
+
+		int len = snprintf(buf, sizeof(buf), "%s=" BLOB_FMT, name, BLOB_PRINTF(*pkg->version));
+		digest_add_local(digest, buf, min((size_t) len, sizeof(buf) - 1));
+
+		if (digest_add_closure(digest, name, strlen(name)) < 0) {
+			return -1;
+		}
+		foreach_array_item(dep, pkg->depends) {
+			if (digest_add_closure(digest, dep->name->name, strlen(dep->name->name)) < 0) {
+				return -1;
+			}
+		}
+	}
+	foreach_array_item(dep, db->world) {
+		int len = snprintf(buf, sizeof(buf), "world:%s %u " BLOB_FMT, dep->name->name,
+		                   (unsigned) dep->result_mask, BLOB_PRINTF(dep->version ? *dep->version : APK_BLOB_NULL));
+		digest_add_local(digest, buf, min((size_t) len, sizeof(buf) - 1));
+
+		if (digest_add_closure(digest, dep->name->name, strlen(dep->name->name)) < 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int digest_package (apk_hash_item item, void *ctx) {
+	const struct apk_package *pkg = item;
+	struct index_digest *digest = ctx;
+	const char *name = pkg->name->name;
+	apk_blob_t csum = APK_BLOB_PTR_LEN((char *) pkg->csum.data, pkg->csum.type);
+
+	bool relevant = digest_in_closure(digest, name, strlen(name));
+	const struct apk_dependency *p;
+	foreach_array_item(p, pkg->provides) {
+		relevant = relevant || digest_in_closure(digest, p->name->name, strlen(p->name->name));
+	}
+	return digest_add_entry(digest, name, strlen(name), pkg->version->ptr, pkg->version->len,
+	                        csum.ptr, csum.len, relevant) < 0 ? -1 : 0;
+}
+
+int backend_index_digest (struct backend_db *bdb, struct report *dest) {
+	struct apk_database *db = &bdb->db;
+	struct index_digest *digest = &dest->digest;
+
+	dest->index_fingerprint = index_fingerprint(db);
+
+	if (digest_local(db, digest) < 0
+			|| apk_hash_foreach(&db->available.packages, digest_package, digest) != 0) {
+		digest_free(digest);
+		return -1;
+	}
+	digest_finish(digest);
+
+	return 0;
+}
+
+// Counts installed packages depending on each so: name.
+static int build_abi_index (struct apk_database *db, struct abi_index *dest) {
+	const struct apk_installed_package *ipkg;
+	const struct apk_dependency *dep;
+
+	list_for_each_entry(ipkg, &db->installed.packages, installed_pkgs_list) {
+		foreach_array_item(dep, ipkg->pkg->depends) {
+			const char *name = dep->name->name;
+			if (abi_is_soname(name) && abi_add_dependency(dest, name, strlen(name)) < 0) {
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+static bool provides_name (const struct apk_package *pkg, const struct apk_name *name) {
+	const struct apk_dependency *p;
+
+	foreach_array_item(p, pkg->provides) {
+		if (p->name == name) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void apk_change_to_upgrade (struct upgrade *dest, const struct apk_package *old_pkg,
+                                   const struct apk_package *new_pkg, const struct abi_index *abi) {
+	assert(old_pkg && "change.old_pkg is NULL");
+	assert(old_pkg->name && "change.old_pkg.name is NULL");
+	assert(new_pkg && "change.new_pkg is NULL");
+
+	dest->name = strdup(old_pkg->name->name);
+	dest->origin = apk_blob_cstr(*old_pkg->origin);
+	dest->old_version = apk_blob_cstr(*old_pkg->version);
+	dest->new_version = apk_blob_cstr(*new_pkg->version);
+
+	const struct apk_dependency *p;
+	foreach_array_item(p, old_pkg->provides) {
+		if (abi_is_soname(p->name->name) && !provides_name(new_pkg, p->name)) {
+			abi_add_removed(dest, abi, p->name->name);
+		}
+	}
+}
+
+int backend_find_upgrades (struct backend_db *bdb, struct report *dest) {
+	struct apk_database *db = &bdb->db;
+	assert(db->open_complete);
+
+	dest->index_fingerprint = index_fingerprint(db);
+
+	struct apk_changeset changeset = {0};
+	if (apk_solver_solve(db, APK_SOLVERF_UPGRADE, db->world, &changeset) != 0) {
+		return -1;
+	}
+
+	profile_phase("serialize");
+	if (!(dest->upgrades = calloc(changeset.changes->num, sizeof(struct upgrade)))
+			&& changeset.changes->num > 0) {
+		apk_change_array_free(&changeset.changes);
+		return -1;
+	}
+
+	struct abi_index abi = {0};
+	if (build_abi_index(db, &abi) < 0) {
+		apk_change_array_free(&changeset.changes);
+		abi_free(&abi);
+		return -1;
+	}
+
+	struct apk_change *change;
+	foreach_array_item(change, changeset.changes) {
+		if (change->old_pkg != change->new_pkg) {
+			apk_change_to_upgrade(&dest->upgrades[dest->upgrades_num++], change->old_pkg, change->new_pkg, &abi);
+		}
+	}
+	apk_change_array_free(&changeset.changes);
+	abi_free(&abi);
+
+	return 0;
+}
+
+static const struct apk_installed_package *installed_provider (const struct apk_name *name) {
+	const struct apk_provider *p;
+
+	foreach_array_item(p, name->providers) {
+		if (p->pkg->ipkg) {
+			return p->pkg->ipkg;
+		}
+	}
+	return NULL;
+}
+
+void backend_db_health (struct backend_db *bdb, struct db_health *dest) {
+	struct apk_database *db = &bdb->db;
+	const struct apk_installed_package *ipkg;
+	const struct apk_dependency *dep;
+
+	*dest = (struct db_health) { .known = true };
+
+	list_for_each_entry(ipkg, &db->installed.packages, installed_pkgs_list) {
+		dest->broken_files += ipkg->broken_files;
+		dest->broken_scripts += ipkg->broken_script;
+		dest->broken_xattrs += ipkg->broken_xattr;
+	}
+	foreach_array_item(dep, db->world) {
+		if (!dep->conflict && !installed_provider(dep->name)) {
+			dest->missing_world++;
+		}
+	}
+}
+
+void backend_tag_stats (struct backend_db *bdb, struct report *dest) {
+	struct apk_database *db = &bdb->db;
+	const struct apk_installed_package *ipkg;
+
+	dest->tags_num = min(db->num_repo_tags, REPORT_MAX_TAGS);
+	for (size_t i = 0; i < dest->tags_num; i++) {
+		apk_blob_t name = db->repo_tags[i].plain_name;
+		struct tag_stats *tag = &dest->tags[i];
+
+		*tag = (struct tag_stats) {0};
+		snprintf(tag->name, sizeof(tag->name), BLOB_FMT, BLOB_PRINTF(name));
+		if (tag->name[0] == '\0') {
+			snprintf(tag->name, sizeof(tag->name), "untagged");
+		}
+	}
+	list_for_each_entry(ipkg, &db->installed.packages, installed_pkgs_list) {
+		if (ipkg->repository_tag < dest->tags_num) {
+			dest->tags[ipkg->repository_tag].installed++;
+		}
+	}
+	for (size_t i = 0; i < dest->upgrades_num; i++) {
+		const struct apk_name *name = apk_db_query_name(db, APK_BLOB_STR(dest->upgrades[i].name));
+		if (name && (ipkg = installed_provider(name)) && ipkg->repository_tag < dest->tags_num) {
+			dest->tags[ipkg->repository_tag].upgradable++;
+		}
+	}
+}
+
+int backend_footprint (struct backend_db *bdb, struct footprint *dest) {
+	const struct apk_installed_package *ipkg;
+
+	list_for_each_entry(ipkg, &bdb->db.installed.packages, installed_pkgs_list) {
+		const struct apk_package *pkg = ipkg->pkg;
+		apk_blob_t origin = pkg->origin ? *pkg->origin : APK_BLOB_STR(pkg->name->name);
+
+		if (footprint_add(dest, pkg->name->name, origin.ptr, origin.len, pkg->installed_size) < 0) {
+			return -1;
+		}
+	}
+	footprint_finish(dest);
+
+	return 0;
+}
+
+int backend_compare_versions (struct backend_db *bdb, struct report *dest) {
+	struct apk_database *db = &bdb->db;
+	const struct apk_installed_package *ipkg;
+	size_t num = 0;
+
+	list_for_each_entry(ipkg, &db->installed.packages, installed_pkgs_list) {
+		num++;
+	}
+	if (!(dest->upgrades = calloc(num, sizeof(struct upgrade))) && num > 0) {
+		return -1;
+	}
+	struct abi_index abi = {0};
+	if (build_abi_index(db, &abi) < 0) {
+		abi_free(&abi);
+		return -1;
+	}
+	list_for_each_entry(ipkg, &db->installed.packages, installed_pkgs_list) {
+		const struct apk_package *pkg = ipkg->pkg, *best = pkg;
+		const struct apk_provider *p;
+
+		foreach_array_item(p, pkg->name->providers) {
+			const struct apk_package *cand = p->pkg;
+			if (cand->name == pkg->name && (cand->repos & db->available_repos)
+					&& apk_version_compare_blob(*cand->version, *best->version) == APK_VERSION_GREATER) {
+				best = cand;
+			}
+		}
+		if (best != pkg) {
+			apk_change_to_upgrade(&dest->upgrades[dest->upgrades_num++], pkg, best, &abi);
+		}
+	}
+	abi_free(&abi);
+
+	return 0;
+}
+
+// Names of the cache files come from libapk, so they match whatever naming
+// scheme the linked version uses.
+int backend_cached_indexes (struct backend_db *bdb, struct cached_index **dest) {
+	struct apk_database *db = &bdb->db;
+	int num = 0;
+
+	struct cached_index *indexes = calloc(db->num_repos, sizeof(*indexes));
+	if (!indexes) {
+		return -1;
+	}
+	for (unsigned i = APK_REPOSITORY_FIRST_CONFIGURED; i < db->num_repos; i++) {
+		struct apk_repository *repo = &db->repos[i];
+		char file[PATH_MAX], url[PATH_MAX];
+
+		// Local repositories are read in place, not cached.
+		if (apk_url_local_file(repo->url) || apk_repo_format_cache_index(APK_BLOB_BUF(file), repo) < 0) {
+			continue;
+		}
+		snprintf(url, sizeof(url), "%s/" BLOB_FMT "/APKINDEX.tar.gz", repo->url, BLOB_PRINTF(*db->arch));
+
+		struct cached_index *index = &indexes[num++];
+		*index = (struct cached_index) {
+			.url = strdup(url),
+			.file = strdup(file),
+			.available = db->available_repos & (1u << i),
+		};
+		if (!index->url || !index->file) {
+			cached_indexes_free(indexes, num);
+			return -1;
+		}
+	}
+	*dest = indexes;
+
+	return num;
+}
+
+size_t backend_unavailable_repos (struct backend_db *bdb) {
+	const struct apk_database *db = &bdb->db;
+	size_t num = db->repo_update_errors;
+
+	for (unsigned i = APK_REPOSITORY_FIRST_CONFIGURED; i < db->num_repos; i++) {
+		if (!(db->available_repos & (1u << i))) {
+			num++;
+		}
+	}
+	return num;
+}
+
+// libapk names the file after the checksum of the URL, see
+// apk_db_add_repository().
+int backend_cache_file (const char *url, char *dest, size_t size) {
+	struct apk_repository repo = { .url = url };
+
+	apk_blob_checksum(APK_BLOB_STR(url), apk_checksum_default(), &repo.csum);
+
+	return apk_repo_format_cache_index(APK_BLOB_PTR_LEN(dest, size), &repo) < 0 ? -1 : 0;
+}
+
+void backend_close (struct backend_db *bdb) {
+	if (bdb->db.open_complete) {
+		apk_db_close(&bdb->db);
+	}
+	free(bdb->repos);
+	free(bdb);
+}
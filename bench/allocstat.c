@@ -0,0 +1,350 @@
+// SPDX-FileCopyrightText: 2022-present Jakub Jirutka <jakub@jirutka.cz>
+// SPDX-License-Identifier: GPL-2.0-or-later
+//
+// A tiny LD_PRELOAD shim that counts heap allocations. It's used by the
+// benchmark driver only, it's never linked into the plugin.
+//
+// Besides the totals, allocations are attributed to the current phase (set
+// by the plugin when built with -DALLOC_PROFILE, see allocstat_phase()) and
+// to the call site: the first caller outside of libc and this shim, so that
+// e.g. strdup() called from meta_data_add_string() is reported as the latter.
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <link.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unwind.h>
+
+#include "allocstat.h"
+
+#define MAX_PHASES 16
+#define MAX_SITES 4096  // must be power of 2
+#define MAX_FRAMES 12
+#define REPORT_SITES 30
+
+#define PHASE_SHIFT 56
+
+struct counter {
+	atomic_ulong allocs;
+	atomic_ulong bytes;
+};
+
+struct site {
+	_Atomic uint64_t key;  // call site address | phase << PHASE_SHIFT
+	struct counter cnt;
+};
+
+struct range {
+	uintptr_t start;
+	uintptr_t end;
+};
+
+static void *(*real_malloc)(size_t);
+static void *(*real_calloc)(size_t, size_t);
+static void *(*real_realloc)(void *, size_t);
+static void (*real_free)(void *);
+
+static struct counter total;
+
+static const char *phase_names[MAX_PHASES] = { "other" };
+static atomic_uint phases_num = 1;
+static atomic_uint cur_phase = 0;
+
+static struct site sites[MAX_SITES];
+
+// Executable segments of libc and this shim, skipped when looking for
+// a call site.
+static struct range skip_ranges[8];
+static size_t skip_ranges_num;
+
+static _Thread_local int in_hook;
+
+// dlsym() may call calloc() before we know the real one, so serve these
+// early requests from a small static buffer that is never freed.
+static char bootstrap_buf[4096];
+static size_t bootstrap_used;
+
+static int is_bootstrap (const void *ptr) {
+	return (const char *)ptr >= bootstrap_buf
+		&& (const char *)ptr < bootstrap_buf + sizeof(bootstrap_buf);
+}
+
+static void *bootstrap_alloc (size_t size) {
+	size = (size + 15) & ~(size_t)15;
+	if (bootstrap_used + size > sizeof(bootstrap_buf)) {
+		return NULL;
+	}
+	void *ptr = bootstrap_buf + bootstrap_used;
+	bootstrap_used += size;
+
+	return ptr;
+}
+
+static int collect_skip_ranges (struct dl_phdr_info *info, size_t size, void *data) {
+	(void) size;
+	const uintptr_t *addrs = data;
+
+	for (int i = 0; i < info->dlpi_phnum; i++) {
+		const ElfW(Phdr) *ph = &info->dlpi_phdr[i];
+		if (ph->p_type != PT_LOAD || !(ph->p_flags & PF_X)) {
+			continue;
+		}
+		uintptr_t start = info->dlpi_addr + ph->p_vaddr;
+		uintptr_t end = start + ph->p_memsz;
+
+		for (size_t j = 0; j < 2; j++) {
+			if (addrs[j] >= start && addrs[j] < end
+					&& skip_ranges_num < sizeof(skip_ranges) / sizeof(*skip_ranges)) {
+				skip_ranges[skip_ranges_num++] = (struct range) { start, end };
+			}
+		}
+	}
+	return 0;
+}
+
+static void init (void) {
+	static int initializing = 0;
+
+	if (real_malloc || initializing) {
+		return;
+	}
+	initializing = 1;
+	*(void **) &real_calloc = dlsym(RTLD_NEXT, "calloc");
+	*(void **) &real_realloc = dlsym(RTLD_NEXT, "realloc");
+	*(void **) &real_free = dlsym(RTLD_NEXT, "free");
+	*(void **) &real_malloc = dlsym(RTLD_NEXT, "malloc");
+
+	uintptr_t addrs[2] = { (uintptr_t) real_malloc, (uintptr_t) &init };
+	dl_iterate_phdr(collect_skip_ranges, addrs);
+	initializing = 0;
+}
+
+static int is_skipped (uintptr_t addr) {
+	for (size_t i = 0; i < skip_ranges_num; i++) {
+		if (addr >= skip_ranges[i].start && addr < skip_ranges[i].end) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+struct unwind_state {
+	uintptr_t site;
+	int depth;
+};
+
+static _Unwind_Reason_Code unwind_frame (struct _Unwind_Context *ctx, void *data) {
+	struct unwind_state *state = data;
+	uintptr_t ip = _Unwind_GetIP(ctx);
+
+	if (++state->depth > MAX_FRAMES) {
+		return _URC_END_OF_STACK;
+	}
+	if (ip && !is_skipped(ip)) {
+		state->site = ip;
+		return _URC_END_OF_STACK;
+	}
+	return _URC_NO_REASON;
+}
+
+static struct counter *site_counter (uint64_t key) {
+	size_t idx = (key * 0x9E3779B97F4A7C15ull) >> 40;
+
+	for (size_t i = 0; i < MAX_SITES; i++) {
+		struct site *s = &sites[(idx + i) & (MAX_SITES - 1)];
+		uint64_t cur = atomic_load(&s->key);
+
+		if (cur == 0 && atomic_compare_exchange_strong(&s->key, &cur, key)) {
+			return &s->cnt;
+		}
+		if (cur == key) {
+			return &s->cnt;
+		}
+	}
+	return NULL;  // table is full
+}
+
+static void count (size_t size) {
+	atomic_fetch_add_explicit(&total.allocs, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&total.bytes, size, memory_order_relaxed);
+
+	if (in_hook || skip_ranges_num == 0) {
+		return;
+	}
+	in_hook = 1;  // the unwinder may allocate on the first use
+
+	struct unwind_state state = {0};
+	_Unwind_Backtrace(unwind_frame, &state);
+
+	uint64_t key = state.site | (uint64_t) atomic_load(&cur_phase) << PHASE_SHIFT;
+	struct counter *cnt = site_counter(key ? key : 1);
+	if (cnt) {
+		atomic_fetch_add_explicit(&cnt->allocs, 1, memory_order_relaxed);
+		atomic_fetch_add_explicit(&cnt->bytes, size, memory_order_relaxed);
+	}
+	in_hook = 0;
+}
+
+void *malloc (size_t size) {
+	init();
+	if (!real_malloc) {
+		return bootstrap_alloc(size);
+	}
+	count(size);
+
+	return real_malloc(size);
+}
+
+void *calloc (size_t nmemb, size_t size) {
+	init();
+	if (!real_calloc) {
+		return bootstrap_alloc(nmemb * size);  // static buffer is zeroed
+	}
+	count(nmemb * size);
+
+	return real_calloc(nmemb, size);
+}
+
+void *realloc (void *ptr, size_t size) {
+	init();
+	if (!ptr) {
+		return malloc(size);
+	}
+	if (is_bootstrap(ptr) || !real_realloc) {
+		size_t avail = bootstrap_buf + sizeof(bootstrap_buf) - (char *)ptr;
+		void *new = malloc(size);
+		if (new) {
+			memcpy(new, ptr, size < avail ? size : avail);
+		}
+		return new;
+	}
+	count(size);
+
+	return real_realloc(ptr, size);
+}
+
+void free (void *ptr) {
+	if (!ptr || is_bootstrap(ptr)) {
+		return;
+	}
+	init();
+	real_free(ptr);
+}
+
+void allocstat_read (struct allocstat *dest) {
+	dest->allocs = atomic_load(&total.allocs);
+	dest->bytes = atomic_load(&total.bytes);
+}
+
+void allocstat_reset (void) {
+	atomic_store(&total.allocs, 0);
+	atomic_store(&total.bytes, 0);
+
+	for (size_t i = 0; i < MAX_SITES; i++) {
+		atomic_store(&sites[i].key, 0);
+		atomic_store(&sites[i].cnt.allocs, 0);
+		atomic_store(&sites[i].cnt.bytes, 0);
+	}
+	atomic_store(&cur_phase, 0);
+}
+
+void allocstat_phase (const char *name) {
+	unsigned n = atomic_load(&phases_num);
+
+	for (unsigned i = 0; i < n; i++) {
+		if (strcmp(phase_names[i], name) == 0) {
+			atomic_store(&cur_phase, i);
+			return;
+		}
+	}
+	if (n < MAX_PHASES) {
+		phase_names[n] = name;  // the name is expected to be a string literal
+		atomic_store(&phases_num, n + 1);
+		atomic_store(&cur_phase, n);
+	}
+}
+
+struct site_row {
+	char name[96];
+	unsigned phase;
+	unsigned long allocs;
+	unsigned long bytes;
+};
+
+static int cmp_rows (const void *a, const void *b) {
+	const struct site_row *x = a, *y = b;
+	return (x->allocs < y->allocs) - (x->allocs > y->allocs);
+}
+
+static void describe_site (char *dest, size_t size, uintptr_t addr) {
+	Dl_info info = {0};
+
+	if (addr <= 1 || !dladdr((void *) addr, &info)) {
+		snprintf(dest, size, "?");
+		return;
+	}
+	const char *obj = info.dli_fname ? strrchr(info.dli_fname, '/') : NULL;
+	obj = obj ? obj + 1 : info.dli_fname ? info.dli_fname : "?";
+
+	snprintf(dest, size, "%s:%s", obj, info.dli_sname ? info.dli_sname : "?");
+}
+
+void allocstat_report (FILE *out) {
+	static struct site_row rows[MAX_SITES];
+	size_t nrows = 0;
+
+	unsigned nphases = atomic_load(&phases_num);
+	unsigned long phase_allocs[MAX_PHASES] = {0};
+	unsigned long phase_bytes[MAX_PHASES] = {0};
+
+	in_hook = 1;
+
+	// Merge sites by (symbol, phase), addresses within a function differ.
+	for (size_t i = 0; i < MAX_SITES; i++) {
+		uint64_t key = atomic_load(&sites[i].key);
+		if (key == 0) {
+			continue;
+		}
+		unsigned phase = key >> PHASE_SHIFT;
+		unsigned long allocs = atomic_load(&sites[i].cnt.allocs);
+		unsigned long bytes = atomic_load(&sites[i].cnt.bytes);
+
+		phase_allocs[phase] += allocs;
+		phase_bytes[phase] += bytes;
+
+		char name[sizeof(rows[0].name)];
+		describe_site(name, sizeof(name), (uintptr_t) (key & ((UINT64_C(1) << PHASE_SHIFT) - 1)));
+
+		size_t j = 0;
+		while (j < nrows && !(rows[j].phase == phase && strcmp(rows[j].name, name) == 0)) {
+			j++;
+		}
+		if (j == nrows) {
+			memcpy(rows[j].name, name, sizeof(name));
+			rows[j].phase = phase;
+			rows[j].allocs = rows[j].bytes = 0;
+			nrows++;
+		}
+		rows[j].allocs += allocs;
+		rows[j].bytes += bytes;
+	}
+	qsort(rows, nrows, sizeof(*rows), cmp_rows);
+
+	fprintf(out, "%-12s %10s %12s\n", "PHASE", "ALLOCS", "BYTES");
+	for (unsigned i = 0; i < nphases; i++) {
+		fprintf(out, "%-12s %10lu %12lu\n", phase_names[i], phase_allocs[i], phase_bytes[i]);
+	}
+	fprintf(out, "%-12s %10lu %12lu\n\n", "total",
+	        atomic_load(&total.allocs), atomic_load(&total.bytes));
+
+	fprintf(out, "%-12s %-48s %10s %12s\n", "PHASE", "CALL SITE", "ALLOCS", "BYTES");
+	for (size_t i = 0; i < nrows && i < REPORT_SITES; i++) {
+		fprintf(out, "%-12s %-48s %10lu %12lu\n", phase_names[rows[i].phase],
+		        rows[i].name, rows[i].allocs, rows[i].bytes);
+	}
+	in_hook = 0;
+}
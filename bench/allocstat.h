@@ -0,0 +1,17 @@
+// SPDX-FileCopyrightText: 2022-present Jakub Jirutka <jakub@jirutka.cz>
+// SPDX-License-Identifier: GPL-2.0-or-later
+#ifndef ALLOCSTAT_H
+#define ALLOCSTAT_H
+
+#include <stdio.h>
+
+struct allocstat {
+	unsigned long allocs;
+	unsigned long bytes;
+};
+
+typedef void (*allocstat_read_fn)(struct allocstat *dest);
+typedef void (*allocstat_reset_fn)(void);
+typedef void (*allocstat_report_fn)(FILE *out);
+
+#endif
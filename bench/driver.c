@@ -0,0 +1,619 @@
+// SPDX-FileCopyrightText: 2022-present Jakub Jirutka <jakub@jirutka.cz>
+// SPDX-License-Identifier: GPL-2.0-or-later
+//
+// Benchmark driver: loads the plugin the same way collectd does, points it at
+// fixture roots and measures the cost of the read callback. Every fixture runs
+// in a forked child so that its peak RSS is not affected by the others.
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <getopt.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <json.h>  // json-c
+
+#include "allocstat.h"
+
+#define PROG_NAME "bench-driver"
+
+#define DEFAULT_ITERATIONS 5
+
+static const char *METRICS[] = { "wall_ms", "max_rss_kb", "allocs" };
+#define METRICS_NUM (sizeof(METRICS) / sizeof(METRICS[0]))
+
+static bool verbose = false;
+static bool profile = false;
+static bool reuse = false;
+
+
+// -- Minimal implementation of the collectd plugin API used by the plugin --
+
+typedef double gauge_t;
+typedef union { gauge_t gauge; } value_t;
+
+struct meta_entry {
+	char *key;
+	char *value;  // NULL if it's a signed int
+	int64_t signed_int;
+	struct meta_entry *next;
+};
+
+typedef struct meta_data_s {
+	struct meta_entry *head;
+} meta_data_t;
+
+typedef struct {
+	value_t *values;
+	size_t values_len;
+	uint64_t time;
+	uint64_t interval;
+	char host[128];
+	char plugin[128];
+	char plugin_instance[128];
+	char type[128];
+	char type_instance[128];
+	meta_data_t *meta;
+} value_list_t;
+
+typedef struct {
+	void *data;
+	void (*free_func)(void *);
+} user_data_t;
+
+#define OCONFIG_TYPE_STRING 0
+#define OCONFIG_TYPE_NUMBER 1
+#define OCONFIG_TYPE_BOOLEAN 2
+
+typedef struct {
+	union {
+		char *string;
+		double number;
+		int boolean;
+	} value;
+	int type;
+} oconfig_value_t;
+
+typedef struct oconfig_item_s oconfig_item_t;
+struct oconfig_item_s {
+	char *key;
+	oconfig_value_t *values;
+	int values_num;
+	oconfig_item_t *parent;
+	oconfig_item_t *children;
+	int children_num;
+};
+
+static int (*read_cb)(void);
+static int (*complex_read_cb)(user_data_t *);
+static int (*config_cb)(oconfig_item_t *ci);
+static int (*init_cb)(void);
+static int (*shutdown_cb)(void);
+
+static gauge_t last_upgradable = -1;
+
+meta_data_t *meta_data_create (void) {
+	return calloc(1, sizeof(meta_data_t));
+}
+
+void meta_data_destroy (meta_data_t *md) {
+	if (!md) {
+		return;
+	}
+	struct meta_entry *next = NULL;
+	for (struct meta_entry *e = md->head; e; e = next) {
+		next = e->next;
+		free(e->key);
+		free(e->value);
+		free(e);
+	}
+	free(md);
+}
+
+// Copies the key and value like collectd's implementation does, so that
+// allocation counts are comparable with the real thing.
+int meta_data_add_string (meta_data_t *md, const char *key, const char *value) {
+	struct meta_entry *e = calloc(1, sizeof(*e));
+	if (!e) {
+		return -1;
+	}
+	e->key = strdup(key);
+	e->value = strdup(value);
+	e->next = md->head;
+	md->head = e;
+
+	return 0;
+}
+
+int meta_data_add_signed_int (meta_data_t *md, const char *key, int64_t value) {
+	struct meta_entry *e = calloc(1, sizeof(*e));
+	if (!e) {
+		return -1;
+	}
+	e->key = strdup(key);
+	e->signed_int = value;
+	e->next = md->head;
+	md->head = e;
+
+	return 0;
+}
+
+int plugin_dispatch_values (value_list_t const *vl) {
+	if (strcmp(vl->plugin_instance, "upgradable") == 0) {
+		last_upgradable = vl->values[0].gauge;
+	}
+	return 0;
+}
+
+int plugin_register_read (const char *name, int (*callback)(void)) {
+	(void) name;
+	read_cb = callback;
+	return 0;
+}
+
+int plugin_register_complex_read (const char *group, const char *name,
+                                  int (*callback)(user_data_t *), uint64_t interval,
+                                  user_data_t const *user_data) {
+	(void) group; (void) name; (void) interval; (void) user_data;
+	complex_read_cb = callback;
+	return 0;
+}
+
+int plugin_register_init (const char *name, int (*callback)(void)) {
+	(void) name;
+	init_cb = callback;
+	return 0;
+}
+
+int plugin_register_shutdown (const char *name, int (*callback)(void)) {
+	(void) name;
+	shutdown_cb = callback;
+	return 0;
+}
+
+// Interval of the plugin as cdtime_t (2^-30 seconds).
+uint64_t plugin_get_interval (void) {
+	return (uint64_t) 10 << 30;
+}
+
+int plugin_register_complex_config (const char *name, int (*callback)(oconfig_item_t *ci)) {
+	(void) name;
+	config_cb = callback;
+	return 0;
+}
+
+// The driver doesn't use ReloadFile.
+oconfig_item_t *oconfig_parse_file (const char *file) {
+	(void) file;
+	return NULL;
+}
+
+void oconfig_free (oconfig_item_t *ci) {
+	(void) ci;
+}
+
+static int cf_util_get_value (const oconfig_item_t *ci, int type, oconfig_value_t *dest) {
+	if (ci->values_num != 1 || ci->values[0].type != type) {
+		fprintf(stderr, PROG_NAME ": invalid value of %s\n", ci->key);
+		return -1;
+	}
+	*dest = ci->values[0];
+	return 0;
+}
+
+int cf_util_get_string (const oconfig_item_t *ci, char **ret_string) {
+	oconfig_value_t value;
+	if (cf_util_get_value(ci, OCONFIG_TYPE_STRING, &value) < 0) {
+		return -1;
+	}
+	free(*ret_string);
+	*ret_string = strdup(value.value.string);
+	return *ret_string ? 0 : -1;
+}
+
+int cf_util_get_double (const oconfig_item_t *ci, double *ret_value) {
+	oconfig_value_t value;
+	if (cf_util_get_value(ci, OCONFIG_TYPE_NUMBER, &value) < 0) {
+		return -1;
+	}
+	*ret_value = value.value.number;
+	return 0;
+}
+
+int cf_util_get_int (const oconfig_item_t *ci, int *ret_value) {
+	double value;
+	if (cf_util_get_double(ci, &value) < 0) {
+		return -1;
+	}
+	*ret_value = (int) value;
+	return 0;
+}
+
+int cf_util_get_boolean (const oconfig_item_t *ci, bool *ret_bool) {
+	oconfig_value_t value;
+	if (cf_util_get_value(ci, OCONFIG_TYPE_BOOLEAN, &value) < 0) {
+		return -1;
+	}
+	*ret_bool = value.value.boolean;
+	return 0;
+}
+
+void plugin_log (int level, const char *format, ...) {
+	if (level > LOG_WARNING && !verbose) {
+		return;
+	}
+	va_list ap;
+	va_start(ap, format);
+	vfprintf(stderr, format, ap);
+	va_end(ap);
+	fputc('\n', stderr);
+}
+
+
+// -- Measurement --
+
+struct sample {
+	int rc;
+	double wall_ms;
+	long allocs;
+	long alloc_bytes;
+	gauge_t upgradable;
+};
+
+static double now_ms (void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static int cmp_double (const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+// Runs in the forked child.
+static struct sample run_plugin (const char *plugin_path, const char *root, int iterations) {
+	struct sample s = { .rc = -1, .allocs = -1, .alloc_bytes = -1 };
+
+	void *handle = dlopen(plugin_path, RTLD_NOW | RTLD_GLOBAL);
+	if (!handle) {
+		fprintf(stderr, PROG_NAME ": %s\n", dlerror());
+		return s;
+	}
+	void (*module_register)(void);
+	*(void **) &module_register = dlsym(handle, "module_register");
+	if (!module_register) {
+		fprintf(stderr, PROG_NAME ": %s\n", dlerror());
+		return s;
+	}
+	module_register();
+
+	if (!config_cb) {
+		fprintf(stderr, PROG_NAME ": plugin did not register config callback\n");
+		return s;
+	}
+	oconfig_value_t values[] = {
+		{ .value.string = (char *) root, .type = OCONFIG_TYPE_STRING },
+		{ .value.boolean = true, .type = OCONFIG_TYPE_BOOLEAN },
+		{ .value.string = "", .type = OCONFIG_TYPE_STRING },  // every run must start cold
+		{ .value.boolean = reuse, .type = OCONFIG_TYPE_BOOLEAN },
+	};
+	oconfig_item_t children[] = {
+		{ .key = "RootDir", .values = &values[0], .values_num = 1 },
+		{ .key = "AllowUntrusted", .values = &values[1], .values_num = 1 },
+		{ .key = "SnapshotFile", .values = &values[2], .values_num = 1 },
+		{ .key = "ReuseResult", .values = &values[3], .values_num = 1 },
+	};
+	oconfig_item_t block = { .key = "Plugin", .children = children, .children_num = 4 };
+	if (config_cb(&block) != 0) {
+		fprintf(stderr, PROG_NAME ": plugin config failed\n");
+		return s;
+	}
+
+	if (init_cb && init_cb() != 0) {
+		fprintf(stderr, PROG_NAME ": plugin init failed\n");
+		return s;
+	}
+	if (!read_cb && !complex_read_cb) {
+		fprintf(stderr, PROG_NAME ": plugin did not register read callback\n");
+		return s;
+	}
+
+	// Provided by allocstat.so if it's preloaded.
+	allocstat_read_fn alloc_read;
+	allocstat_reset_fn alloc_reset;
+	allocstat_report_fn alloc_report;
+	*(void **) &alloc_read = dlsym(RTLD_DEFAULT, "allocstat_read");
+	*(void **) &alloc_reset = dlsym(RTLD_DEFAULT, "allocstat_reset");
+	*(void **) &alloc_report = dlsym(RTLD_DEFAULT, "allocstat_report");
+
+	// Solve once untimed, so that all the measured reads reuse its result.
+	if (reuse && (s.rc = read_cb ? read_cb() : complex_read_cb(NULL)) != 0) {
+		return s;
+	}
+
+	double *times = calloc(iterations, sizeof(double));
+	for (int i = 0; i < iterations; i++) {
+		struct allocstat as = {0};
+		if (alloc_reset) {
+			alloc_reset();
+		}
+		double start = now_ms();
+		if ((s.rc = read_cb ? read_cb() : complex_read_cb(NULL)) != 0) {
+			break;
+		}
+		times[i] = now_ms() - start;
+
+		if (alloc_read) {
+			alloc_read(&as);
+			s.allocs = as.allocs;
+			s.alloc_bytes = as.bytes;
+		}
+	}
+	// Counters are reset before each iteration, so this covers the last one.
+	if (profile && alloc_report) {
+		fprintf(stderr, "\n== %s\n", root);
+		alloc_report(stderr);
+	}
+	if (s.rc == 0) {
+		qsort(times, iterations, sizeof(double), cmp_double);
+		s.wall_ms = times[iterations / 2];  // median
+	}
+	s.upgradable = last_upgradable;
+	free(times);
+
+	if (shutdown_cb) {
+		shutdown_cb();
+	}
+
+	return s;
+}
+
+static json_object *measure_fixture (const char *plugin_path, const char *root, int iterations) {
+	int fds[2];
+	if (pipe(fds) < 0) {
+		return NULL;
+	}
+
+	fflush(stdout);
+	pid_t pid = fork();
+	if (pid < 0) {
+		return NULL;
+	}
+	if (pid == 0) {
+		close(fds[0]);
+		struct sample s = run_plugin(plugin_path, root, iterations);
+		// Not _exit(), the plugin built with PGO=generate writes profile at exit.
+		exit(write(fds[1], &s, sizeof(s)) == sizeof(s) && s.rc == 0 ? 0 : 1);
+	}
+	close(fds[1]);
+
+	struct sample s = { .rc = -1 };
+	ssize_t n = read(fds[0], &s, sizeof(s));
+	close(fds[0]);
+
+	int status = 0;
+	struct rusage ru = {0};
+	if (wait4(pid, &status, 0, &ru) < 0 || n != sizeof(s) || s.rc != 0) {
+		return NULL;
+	}
+
+	json_object *obj = json_object_new_object();
+	json_object_object_add(obj, "wall_ms", json_object_new_double(s.wall_ms));
+	json_object_object_add(obj, "max_rss_kb", json_object_new_int64(ru.ru_maxrss));
+	json_object_object_add(obj, "allocs", s.allocs < 0 ? NULL : json_object_new_int64(s.allocs));
+	json_object_object_add(obj, "alloc_bytes", s.alloc_bytes < 0 ? NULL : json_object_new_int64(s.alloc_bytes));
+	json_object_object_add(obj, "upgradable", json_object_new_int64((int64_t) s.upgradable));
+
+	return obj;
+}
+
+
+// -- Baseline comparison --
+
+// Compares one fixture's results with its baseline and records the names of
+// regressed metrics in the "regressions" array. Returns number of regressions,
+// or -1 if the baseline has no value of a measured metric.
+static int compare_fixture (const char *name, json_object *result, json_object *baseline, json_object *tolerance) {
+	json_object *regressions = json_object_new_array();
+	bool unrecorded = false;
+
+	for (size_t i = 0; i < METRICS_NUM; i++) {
+		json_object *measured = NULL, *expected = NULL, *tol = NULL;
+
+		// A missing or null value means "not measured", e.g. allocstat.so not
+		// preloaded, so there's nothing to compare.
+		if (!json_object_object_get_ex(result, METRICS[i], &measured) || !measured) {
+			continue;
+		}
+		// A baseline without the value would let any regression pass.
+		if (!json_object_object_get_ex(baseline, METRICS[i], &expected) || !expected) {
+			fprintf(stderr, PROG_NAME ": baseline has no %s of fixture %s\n", METRICS[i], name);
+			unrecorded = true;
+			continue;
+		}
+		double limit = json_object_get_double(expected);
+		if (json_object_object_get_ex(tolerance, METRICS[i], &tol) && tol) {
+			limit *= 1.0 + json_object_get_double(tol);
+		}
+		if (json_object_get_double(measured) > limit) {
+			json_object_array_add(regressions, json_object_new_string(METRICS[i]));
+		}
+	}
+	int count = json_object_array_length(regressions);
+	json_object_object_add(result, "regressions", regressions);
+
+	return unrecorded ? -1 : count;
+}
+
+// Returns true if the fixture's baseline has a value of any metric, i.e. it
+// has been recorded on this machine.
+static bool is_recorded (json_object *baseline) {
+	json_object *value = NULL;
+
+	for (size_t i = 0; i < METRICS_NUM; i++) {
+		if (json_object_object_get_ex(baseline, METRICS[i], &value) && value) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Adds relative change of each metric against the reference results, e.g.
+// -0.12 means 12 % less than in the reference.
+static void add_changes (json_object *result, json_object *reference) {
+	json_object *changes = json_object_new_object();
+
+	for (size_t i = 0; i < METRICS_NUM; i++) {
+		json_object *measured = NULL, *ref = NULL;
+
+		if (!json_object_object_get_ex(result, METRICS[i], &measured) || !measured
+				|| !json_object_object_get_ex(reference, METRICS[i], &ref) || !ref
+				|| json_object_get_double(ref) == 0) {
+			continue;
+		}
+		double change = json_object_get_double(measured) / json_object_get_double(ref) - 1.0;
+		json_object_object_add(changes, METRICS[i], json_object_new_double(change));
+	}
+	json_object_object_add(result, "change", changes);
+}
+
+static void update_baseline (json_object *baseline, const char *name, json_object *result) {
+	json_object *fixtures = NULL;
+	if (!json_object_object_get_ex(baseline, "fixtures", &fixtures) || !fixtures) {
+		fixtures = json_object_new_object();
+		json_object_object_add(baseline, "fixtures", fixtures);
+	}
+	json_object *entry = json_object_new_object();
+	for (size_t i = 0; i < METRICS_NUM; i++) {
+		json_object *value = NULL;
+		json_object_object_get_ex(result, METRICS[i], &value);
+		json_object_object_add(entry, METRICS[i], json_object_get(value));
+	}
+	json_object_object_add(fixtures, name, entry);
+}
+
+
+static void usage (FILE *out) {
+	fprintf(out,
+		"Usage: " PROG_NAME " [-pRv] [-n ITERATIONS] [-b BASELINE [-u]] [-r REFERENCE] PLUGIN NAME=ROOT...\n"
+		"\n"
+		"Load collectd plugin PLUGIN, run its read callback against each fixture\n"
+		"ROOT and print results as JSON. With -b, compare results with BASELINE\n"
+		"and exit with 2 if any metric exceeds its tolerance; with -u, write the\n"
+		"results into BASELINE instead. With -p, print allocations per phase and\n"
+		"call site to stderr (requires allocstat.so to be preloaded). With -r,\n"
+		"report relative change of each metric against REFERENCE (a previous\n"
+		"output of this program). Every read runs the solver, unless -R is given;\n"
+		"then the measured reads reuse the result of an untimed first read.\n");
+}
+
+int main (int argc, char **argv) {
+	int iterations = DEFAULT_ITERATIONS;
+	const char *baseline_path = NULL;
+	const char *reference_path = NULL;
+	bool update = false;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "b:hn:pRr:uv")) != -1) {
+		switch (opt) {
+			case 'b': baseline_path = optarg; break;
+			case 'n': iterations = atoi(optarg); break;
+			case 'p': profile = true; break;
+			case 'R': reuse = true; break;
+			case 'r': reference_path = optarg; break;
+			case 'u': update = true; break;
+			case 'v': verbose = true; break;
+			case 'h': usage(stdout); return 0;
+			default: usage(stderr); return 1;
+		}
+	}
+	if (argc - optind < 2 || iterations < 1 || (update && !baseline_path)) {
+		usage(stderr);
+		return 1;
+	}
+	const char *plugin_path = argv[optind++];
+
+	json_object *baseline = NULL, *tolerance = NULL, *expected = NULL;
+	if (baseline_path) {
+		if (!(baseline = json_object_from_file(baseline_path))) {
+			fprintf(stderr, PROG_NAME ": failed to read baseline %s\n", baseline_path);
+			return 1;
+		}
+		json_object_object_get_ex(baseline, "tolerance", &tolerance);
+		json_object_object_get_ex(baseline, "fixtures", &expected);
+	}
+	json_object *reference_file = NULL, *reference = NULL;
+	if (reference_path) {
+		if (!(reference_file = json_object_from_file(reference_path))) {
+			fprintf(stderr, PROG_NAME ": failed to read reference %s\n", reference_path);
+			return 1;
+		}
+		json_object_object_get_ex(reference_file, "fixtures", &reference);
+	}
+
+	int failed = 0, regressed = 0;
+	json_object *fixtures = json_object_new_object();
+
+	for (; optind < argc; optind++) {
+		char *name = argv[optind];
+		char *root = strchr(name, '=');
+		if (!root) {
+			usage(stderr);
+			return 1;
+		}
+		*root++ = '\0';
+
+		json_object *result = measure_fixture(plugin_path, root, iterations);
+		if (!result) {
+			fprintf(stderr, PROG_NAME ": fixture %s failed\n", name);
+			failed++;
+			continue;
+		}
+		json_object *fixture_baseline = NULL;
+		if (update) {
+			update_baseline(baseline, name, result);
+		} else if (json_object_object_get_ex(expected, name, &fixture_baseline) && is_recorded(fixture_baseline)) {
+			int r = compare_fixture(name, result, fixture_baseline, tolerance);
+			failed += r < 0;
+			regressed += r > 0;
+			add_changes(result, fixture_baseline);
+		} else if (baseline) {
+			// The numbers depend on the machine, so the baseline in the
+			// repository doesn't have them until someone records them.
+			fprintf(stderr, PROG_NAME ": baseline has no numbers of fixture %s, "
+					"skipping comparison (run make bench-baseline to record them)\n", name);
+		}
+		json_object *fixture_reference = NULL;
+		if (json_object_object_get_ex(reference, name, &fixture_reference)) {
+			add_changes(result, fixture_reference);
+		}
+		json_object_object_add(fixtures, name, result);
+	}
+
+	json_object *report = json_object_new_object();
+	json_object_object_add(report, "iterations", json_object_new_int(iterations));
+	json_object_object_add(report, "fixtures", fixtures);
+	json_object_object_add(report, "ok", json_object_new_boolean(!failed && !regressed));
+	printf("%s\n", json_object_to_json_string_ext(report, JSON_C_TO_STRING_PRETTY));
+
+	if (update && json_object_to_file_ext(baseline_path, baseline, JSON_C_TO_STRING_PRETTY) < 0) {
+		fprintf(stderr, PROG_NAME ": failed to write baseline %s\n", baseline_path);
+		failed++;
+	}
+	json_object_put(report);
+	json_object_put(baseline);
+	json_object_put(reference_file);
+
+	return failed ? 1 : regressed ? 2 : 0;
+}
@@ -0,0 +1,69 @@
+#!/bin/sh
+# SPDX-FileCopyrightText: 2022-present Jakub Jirutka <jakub@jirutka.cz>
+# SPDX-License-Identifier: GPL-2.0-or-later
+#
+# Usage: gen-fixture.sh NAME DEST
+#
+# Generates a fixture for the benchmark driver: an apk root DEST/root with
+# installed database and world, and a local unsigned repository DEST/repo
+# that the root is configured to use. The content is deterministic and
+# depends only on the fixture NAME.
+set -eu
+
+name="$1"
+dest="$2"
+
+# installed, available, upgradable
+case "$name" in
+	small) set -- 40 400 5;;
+	medium) set -- 250 5000 25;;
+	large) set -- 1500 20000 100;;
+	many-upgradable) set -- 1500 2000 1200;;
+	*) echo "$0: unknown fixture: $name" >&2; exit 1;;
+esac
+
+arch=$(apk --print-arch 2>/dev/null || uname -m)
+root="$dest/root"
+repo="$dest/repo"
+
+rm -rf "$dest"
+mkdir -p "$root"/etc/apk/keys "$root"/lib/apk/db "$repo/$arch"
+dest=$(cd "$dest" && pwd)
+
+# Package i depends on i/2 and i/3, so every prefix of packages is closed
+# under dependencies and the installed set is consistent.
+gen_packages() {
+	awk -v mode="$5" -v from="$1" -v to="$2" -v installed="$3" -v upgradable="$4" -v arch="$arch" '
+		function csum(n) { return sprintf("Q1%027d=", n) }
+		BEGIN {
+			step = int(installed / upgradable); if (step < 1) step = 1
+			for (i = from; i < to; i++) {
+				upgrade = (i < installed && i % step == 0 && i / step < upgradable)
+				ver = (mode == "index" && upgrade) ? "1.1-r0" : "1.0-r0"
+				printf "C:%s\n", csum(i * 2 + (ver == "1.1-r0"))
+				printf "P:pkg%d\nV:%s\nA:%s\n", i, ver, arch
+				printf "S:%d\nI:%d\n", 1024 + i % 4096, (i * 7919 % 100000) * 100
+				printf "T:benchmark fixture package %d\nU:https://example.org/pkg%d\nL:MIT\n", i, i
+				printf "o:origin%d\nm:Bench <bench@example.org>\nt:1660000000\n", int(i / 4)
+				deps = ""
+				if (i > 0) deps = sprintf("pkg%d", int(i / 2))
+				if (i > 2 && int(i / 3) != int(i / 2)) deps = deps sprintf(" pkg%d", int(i / 3))
+				if (deps != "") printf "D:%s\n", deps
+				if (i % 10 == 0) printf "p:so:libpkg%d.so.1=1.0\n", i
+				printf "\n"
+			}
+		}'
+}
+
+gen_packages 0 "$1" "$1" "$3" installed > "$root"/lib/apk/db/installed
+: > "$root"/lib/apk/db/triggers
+
+awk -v n="$1" 'BEGIN { for (i = 0; i < n; i++) printf "pkg%d\n", i }' > "$root"/etc/apk/world
+echo "$arch" > "$root"/etc/apk/arch
+echo "$dest/repo" > "$root"/etc/apk/repositories
+
+cd "$repo/$arch"
+gen_packages 0 "$2" "$1" "$3" index > APKINDEX
+echo "bench-$name" > DESCRIPTION
+tar -c DESCRIPTION APKINDEX | gzip -9 > APKINDEX.tar.gz
+rm DESCRIPTION APKINDEX
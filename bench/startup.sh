@@ -0,0 +1,77 @@
+#!/bin/sh
+# SPDX-FileCopyrightText: 2022-present Jakub Jirutka <jakub@jirutka.cz>
+# SPDX-License-Identifier: GPL-2.0-or-later
+#
+# Usage: startup.sh PLUGIN_DIR [ITERATIONS]
+#
+# Measures the time from starting collectd until it enters the read loop,
+# without and with the plugin from PLUGIN_DIR, and prints the median of each
+# as JSON. collectd runs without a log plugin, so it logs to stderr.
+set -eu
+
+plugin_dir="$(cd "$1" && pwd)"
+iterations="${2:-10}"
+collectd="${COLLECTD:-collectd}"
+timeout=30  # seconds to wait for collectd to start
+
+tmp="$(mktemp -d)"
+trap 'rm -rf "$tmp"' EXIT
+
+# $1: path, $2: "apk" to load the plugin
+write_conf() {
+	cat > "$1" <<-CONF
+		BaseDir "$tmp"
+		PIDFile "$tmp/collectd.pid"
+		PluginDir "$plugin_dir"
+	CONF
+	if [ "$2" = apk ]; then
+		cat >> "$1" <<-CONF
+			<LoadPlugin apk>
+				Interval 86400
+			</LoadPlugin>
+			<Plugin apk>
+				SnapshotFile ""
+			</Plugin>
+		CONF
+	fi
+}
+
+# $1: config; prints microseconds until "Initialization complete"
+measure() {
+	: > "$tmp/log"
+	start=$(date +%s%N)
+	deadline=$((start + timeout * 1000000000))
+	"$collectd" -C "$1" -f 2> "$tmp/log" &
+	pid=$!
+	until grep -q 'Initialization complete' "$tmp/log"; do
+		if ! kill -0 $pid 2>/dev/null; then
+			echo "collectd exited during startup:" >&2
+			cat "$tmp/log" >&2
+			exit 1
+		fi
+		if [ "$(date +%s%N)" -gt $deadline ]; then
+			echo "collectd didn't start in ${timeout}s" >&2
+			kill $pid
+			exit 1
+		fi
+		sleep 0.001
+	done
+	end=$(date +%s%N)
+	kill $pid
+	wait $pid || true
+	echo $(( (end - start) / 1000 ))
+}
+
+for variant in baseline apk; do
+	write_conf "$tmp/$variant.conf" $variant
+	: > "$tmp/times"
+	i=0
+	while [ $i -lt "$iterations" ]; do
+		# Not in a pipeline, so that a failed measurement stops the script.
+		measure "$tmp/$variant.conf" >> "$tmp/times"
+		i=$((i + 1))
+	done
+	sort -n "$tmp/times" | awk -v variant=$variant '
+		{ t[NR] = $1 }
+		END { printf "{\"variant\":\"%s\",\"start_ms\":%.1f}\n", variant, t[int((NR + 1) / 2)] / 1000 }'
+done
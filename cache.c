@@ -0,0 +1,151 @@
+// SPDX-FileCopyrightText: 2022-present Jakub Jirutka <jakub@jirutka.cz>
+// SPDX-License-Identifier: GPL-2.0-or-later
+#define _POSIX_C_SOURCE 200809L
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "core.h"
+
+struct cache_file {
+	char *name;
+	struct timespec atime;
+	uint64_t size;
+};
+
+static int cmp_timespec (const struct timespec *a, const struct timespec *b) {
+	if (a->tv_sec != b->tv_sec) {
+		return a->tv_sec < b->tv_sec ? -1 : 1;
+	}
+	return (a->tv_nsec > b->tv_nsec) - (a->tv_nsec < b->tv_nsec);
+}
+
+static int cmp_atime (const void *a, const void *b) {
+	return cmp_timespec(&((const struct cache_file *)a)->atime, &((const struct cache_file *)b)->atime);
+}
+
+static bool contains (const struct cached_index *indexes, size_t num, const char *file) {
+	for (size_t i = 0; i < num; i++) {
+		if (strcmp(indexes[i].file, file) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void cache_touch (const char *dir, const struct cached_index *indexes, size_t num,
+                  const struct timespec *since, struct cache_stats *stats) {
+	int dir_fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	struct stat st;
+
+	for (size_t i = 0; i < num; i++) {
+		if (dir_fd < 0 || fstatat(dir_fd, indexes[i].file, &st, 0) < 0) {
+			stats->misses++;
+			continue;
+		}
+		if (cmp_timespec(&st.st_mtim, since) >= 0) {
+			stats->misses++;
+		} else {
+			stats->hits++;
+		}
+		const struct timespec times[2] = {
+			{ .tv_nsec = UTIME_NOW },
+			{ .tv_nsec = UTIME_OMIT },
+		};
+		utimensat(dir_fd, indexes[i].file, times, 0);
+	}
+	if (dir_fd >= 0) {
+		close(dir_fd);
+	}
+}
+
+int cache_evict (const char *dir, uint64_t max_bytes, const struct cached_index *keep, size_t keep_num,
+                 struct cache_stats *stats) {
+	int rc = -1;
+	struct cache_file *files = NULL;
+	size_t files_num = 0, files_cap = 0;
+	uint64_t total = 0;
+
+	DIR *dp = opendir(dir);
+	if (!dp) {
+		return -1;
+	}
+	int dir_fd = dirfd(dp);
+
+	struct dirent *ent;
+	while ((errno = 0, ent = readdir(dp))) {
+		struct stat st;
+		if (fstatat(dir_fd, ent->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0 || !S_ISREG(st.st_mode)) {
+			continue;
+		}
+		total += st.st_size;
+
+		if (contains(keep, keep_num, ent->d_name)) {
+			continue;
+		}
+		if (files_num == files_cap) {
+			size_t cap = files_cap ? files_cap * 2 : 32;
+			struct cache_file *tmp = realloc(files, cap * sizeof(*files));
+			if (!tmp) {
+				goto done;
+			}
+			files = tmp;
+			files_cap = cap;
+		}
+		if (!(files[files_num].name = strdup(ent->d_name))) {
+			goto done;
+		}
+		files[files_num].atime = st.st_atim;
+		files[files_num].size = st.st_size;
+		files_num++;
+	}
+	if (errno != 0) {
+		goto done;
+	}
+
+	if (total > max_bytes) {
+		qsort(files, files_num, sizeof(*files), cmp_atime);
+
+		size_t evicted = 0;
+		for (size_t i = 0; i < files_num && total > max_bytes && evicted < CACHE_EVICT_BATCH; i++) {
+			if (unlinkat(dir_fd, files[i].name, 0) < 0) {
+				log_warn("failed to remove %s/%s: %s", dir, files[i].name, strerror(errno));
+				continue;
+			}
+			total -= files[i].size;
+			evicted++;
+		}
+		stats->evictions += evicted;
+	}
+	stats->bytes = total;
+
+	rc = 0;
+done:;
+	int err = errno;
+	for (size_t i = 0; i < files_num; i++) {
+		free(files[i].name);
+	}
+	free(files);
+	closedir(dp);
+	errno = err;
+
+	return rc;
+}
+
+void cached_indexes_free (struct cached_index *indexes, size_t num) {
+	for (size_t i = 0; i < num; i++) {
+		free(indexes[i].url);
+		free(indexes[i].file);
+	}
+	free(indexes);
+}
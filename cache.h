@@ -0,0 +1,50 @@
+// SPDX-FileCopyrightText: 2022-present Jakub Jirutka <jakub@jirutka.cz>
+// SPDX-License-Identifier: GPL-2.0-or-later
+//
+// Size limit of CacheDir. libapk keeps an APKINDEX.<hash>.tar.gz there for
+// every repository it has ever fetched, so the directory only grows when
+// repositories change (e.g. after a release upgrade). The indexes in use are
+// marked by setting their atime after each refresh (explicitly, so it works
+// with noatime mounts too) and the least recently used files are evicted
+// until the directory fits the limit. Eviction is incremental: at most
+// CACHE_EVICT_BATCH files are removed per refresh.
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#define CACHE_EVICT_BATCH 8
+
+// Index of a remote repository in use, held in the cache directory.
+struct cached_index {
+	char *url;  // of the index, e.g. https://host/alpine/v3.20/main/x86_64/APKINDEX.tar.gz
+	char *file;  // name of the file in the cache directory
+	bool available;  // libapk has loaded it and verified its signature
+};
+
+struct cache_stats {
+	size_t hits;  // indexes used from the cache without downloading
+	size_t misses;  // indexes downloaded, or not available in the cache
+	size_t evictions;  // files removed
+	uint64_t bytes;  // size of the cache after eviction, 0 if not known
+};
+
+// Marks the files of the indexes in dir as used now and counts them into
+// stats: as a hit if the file wasn't modified since the time since (the
+// start of the refresh), as a miss otherwise.
+void cache_touch (const char *dir, const struct cached_index *indexes, size_t num,
+                  const struct timespec *since, struct cache_stats *stats);
+
+// Removes the least recently used regular files from dir, except those of
+// keep, until its size is at most max_bytes or CACHE_EVICT_BATCH files are
+// removed, and sets stats->bytes. Returns 0 on success, or -1 on error with
+// errno set.
+int cache_evict (const char *dir, uint64_t max_bytes, const struct cached_index *keep, size_t keep_num,
+                 struct cache_stats *stats);
+
+void cached_indexes_free (struct cached_index *indexes, size_t num);
+
+#endif
@@ -0,0 +1,11 @@
+#!/bin/sh
+# apk commit hook: tells the collectd apk plugin to re-check upgradable
+# packages right after a transaction. The FIFO path must match TriggerFifo.
+FIFO="${COLLECTD_APK_FIFO:-/run/collectd-apk.fifo}"
+
+[ "$1" = 'post-commit' ] || exit 0
+[ -p "$FIFO" ] || exit 0
+
+# The plugin keeps the FIFO open, so this doesn't block; timeout is just
+# a safety net to never stall apk.
+timeout 1 sh -c 'echo refresh > "$1"' -- "$FIFO" 2>/dev/null || true
@@ -0,0 +1,712 @@
+// SPDX-FileCopyrightText: 2022-present Jakub Jirutka <jakub@jirutka.cz>
+// SPDX-License-Identifier: GPL-2.0-or-later
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+
+#include <json.h>  // json-c
+
+#include "backend.h"
+#include "core.h"
+
+#define SNAPSHOT_MAGIC "APKSNAP3"
+#define SOLVE_REPROBE_INTERVAL 8
+
+// This is a very simplified implementation, it does not support escaping
+// (`"behold \"x\" var"`) nor doubled quote character (`"dont ""do this"`).
+static int parse_enclosed_word (char *dest, const char *str, size_t max_len) {
+	size_t len = 0;
+	const char *end = NULL;
+
+	// /^"([^"]*)".*/ or /^'([^']*)'.*/
+	if (str[0] == '"' || str[0] == '\'') {
+		if (!(end = strchr(str + 1, str[0]))) {
+			return -1;
+		}
+		len = end - ++str;
+	// /^([^ \t\r\n;]*).*/
+	} else {
+		len = strcspn(str, " \t\r\n;");
+	}
+	strncpy(dest, str, min(len, max_len));
+
+	return len;
+}
+
+int read_os_release (struct os_release *dest, const char *root_dir) {
+	FILE *fp = NULL;
+
+	char path[4096] = OS_RELEASE_PATH;
+	if (root_dir) {
+		snprintf(path, sizeof(path), "%s" OS_RELEASE_PATH, root_dir);
+	}
+	if (!(fp = fopen(path, "r"))) {
+		return -1;
+	}
+
+	char line[128] = {0};
+	while (fgets(line, sizeof(line), fp)) {
+		char key[16] = {0};
+		int pos = 0;
+		if (sscanf(line, " %15[A-Za-z0-9_]=%n", key, &pos) < 1) {
+		//                ^ ^-- this MUST match sizeof(key) - 1
+		//                `---- allow zero or more whitespace chars at the beginning
+			continue;
+		}
+		char *rest = line + pos;
+
+		if (strcmp(key, "ID") == 0) {
+			parse_enclosed_word(dest->id, rest, sizeof(dest->id));
+		} else if (strcmp(key, "VERSION_ID") == 0) {
+			parse_enclosed_word(dest->version_id, rest, sizeof(dest->version_id));
+		}
+
+	}
+	fclose(fp);
+
+	return 0;
+}
+
+// Returns the URL of the repository, i.e. without the "@tag " prefix.
+static const char *repository_url (const char *repo) {
+	if (*repo == '@') {
+		repo += strcspn(repo, " \t");
+		repo += strspn(repo, " \t");
+	}
+	return repo;
+}
+
+// Reads the repositories configured in root_dir (etc/apk/repositories),
+// with the "@tag " prefix of tagged ones and without trailing slashes.
+// Returns their number, or -1 on error. Free them with free_strings().
+static int read_repositories (char ***dest, const char *root_dir) {
+	char path[4096];
+	snprintf(path, sizeof(path), "%s/etc/apk/repositories", root_dir ? root_dir : "");
+
+	FILE *fp = fopen(path, "r");
+	if (!fp) {
+		return -1;
+	}
+	char **repos = NULL;
+	int num = 0;
+
+	char line[4096];
+	while (fgets(line, sizeof(line), fp)) {
+		char *repo = line + strspn(line, " \t");
+		repo[strcspn(repo, "\r\n")] = '\0';
+
+		const char *url = repository_url(repo);
+		if (*url == '\0' || *url == '#' || *repo == '#') {
+			continue;
+		}
+		size_t len = strlen(repo);
+		while (len > 0 && repo[len - 1] == '/') {
+			repo[--len] = '\0';
+		}
+
+		char **tmp = realloc(repos, (num + 1) * sizeof(char *));
+		if (!tmp) {
+			goto fail;
+		}
+		repos = tmp;
+
+		if (!(repos[num] = strdup(repo))) {
+			goto fail;
+		}
+		num++;
+	}
+	fclose(fp);
+	*dest = repos;
+
+	return num;
+fail:
+	fclose(fp);
+	free_strings(repos, num);
+
+	return -1;
+}
+
+// Reads the first line of root_dir/path into dest, without the newline.
+static int read_first_line (char *dest, size_t size, const char *root_dir, const char *path) {
+	char full_path[4096];
+	snprintf(full_path, sizeof(full_path), "%s%s", root_dir ? root_dir : "", path);
+
+	FILE *fp = fopen(full_path, "r");
+	if (!fp) {
+		return -1;
+	}
+	char *line = fgets(dest, size, fp);
+	fclose(fp);
+
+	if (!line) {
+		return -1;
+	}
+	dest[strcspn(dest, "\r\n")] = '\0';
+
+	return 0;
+}
+
+// Names of the machine from uname(2) that differ from apk's architecture
+// names (the others, e.g. x86_64 or aarch64, are the same).
+static const char *const MACHINE_ARCHS[][2] = {
+	{ "i386", "x86" },
+	{ "i486", "x86" },
+	{ "i586", "x86" },
+	{ "i686", "x86" },
+	{ "armv6l", "armhf" },
+	{ "armv7l", "armv7" },
+	{ "armv8l", "armv7" },  // 32-bit userland on a 64-bit CPU
+};
+
+int read_arch (char *dest, size_t size, const char *root_dir) {
+	if (read_first_line(dest, size, root_dir, "/etc/apk/arch") < 0 || !*dest) {
+		struct utsname uts;
+		if (uname(&uts) < 0) {
+			return -1;
+		}
+		const char *arch = uts.machine;
+		for (size_t i = 0; i < STATIC_ARRAY_SIZE(MACHINE_ARCHS); i++) {
+			if (strcmp(arch, MACHINE_ARCHS[i][0]) == 0) {
+				arch = MACHINE_ARCHS[i][1];
+				break;
+			}
+		}
+		snprintf(dest, size, "%s", arch);
+	}
+	return 0;
+}
+
+void free_strings (char **strs, size_t num) {
+	for (size_t i = 0; i < num; i++) {
+		free(strs[i]);
+	}
+	free(strs);
+}
+
+static double now_ms (void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static int copy_upgrades (struct report *dest, const struct report *src) {
+	if (src->upgrades_num > 0 && !(dest->upgrades = calloc(src->upgrades_num, sizeof(struct upgrade)))) {
+		return -1;
+	}
+	for (; dest->upgrades_num < src->upgrades_num; dest->upgrades_num++) {
+		const struct upgrade *s = &src->upgrades[dest->upgrades_num];
+		struct upgrade *d = &dest->upgrades[dest->upgrades_num];
+
+		if (!(d->name = strdup(s->name))
+				|| !(d->origin = strdup(s->origin))
+				|| !(d->old_version = strdup(s->old_version))
+				|| !(d->new_version = strdup(s->new_version))
+				|| (s->abi_removed && !(d->abi_removed = strdup(s->abi_removed)))) {
+			dest->upgrades_num++;  // free the partially copied entry too
+			return -1;
+		}
+		d->abi_dependents = s->abi_dependents;
+	}
+	return 0;
+}
+
+// Returns true if the upgrades of prev are still valid for dest, i.e. they
+// come from the solver, the installed packages and world are the same and no
+// changed index entry touches them. Sets dest->index_changed.
+static bool can_reuse (struct report *dest, const struct report *prev) {
+	struct index_delta delta = {0};
+
+	// A reused report carries the upgrades of the solve it was reused from,
+	// but the compared ones ignore dependencies and pinning.
+	if (!prev || prev->mode == REPORT_COMPARED
+			|| prev->digest.entries_num == 0 || dest->digest.entries_num == 0) {
+		return false;
+	}
+	bool comparable = digest_compare(&prev->digest, &dest->digest, &delta);
+	dest->index_changed = delta.changed;
+
+	return comparable && delta.relevant == 0;
+}
+
+// The solver's work grows with the number of available packages and names in
+// the installed closure; this is the unit the cost model counts in.
+static double solve_units (const struct report *report) {
+	return report->digest.entries_num + report->digest.closure_num;
+}
+
+// The estimate is updated only by solves, so every SOLVE_REPROBE_INTERVAL-th
+// refresh over the budget solves anyway; otherwise a single slow solve (e.g.
+// on a cold page cache) would leave the plugin comparing versions for good.
+static bool over_budget (const struct report *dest, const struct core_options *opts) {
+	struct solve_model *model = opts->model;
+
+	if (opts->solve_budget_ms <= 0 || !model || model->ms_per_unit <= 0) {
+		return false;
+	}
+	double predicted_ms = model->ms_per_unit * solve_units(dest);
+	if (predicted_ms <= opts->solve_budget_ms) {
+		model->compared_num = 0;
+		return false;
+	}
+	if (++model->compared_num >= SOLVE_REPROBE_INTERVAL) {
+		log_info("predicted solve time %.0f ms exceeds the budget of %.0f ms, solving anyway to re-check it",
+		         predicted_ms, opts->solve_budget_ms);
+		model->compared_num = 0;
+		return false;
+	}
+	log_info("predicted solve time %.0f ms exceeds the budget of %.0f ms, comparing versions only",
+	         predicted_ms, opts->solve_budget_ms);
+	return true;
+}
+
+// Exponentially weighted, so a single outlier doesn't flip the mode.
+static void update_model (struct solve_model *model, double solve_ms, double units) {
+	if (!model || units <= 0) {
+		return;
+	}
+	double sample = solve_ms / units;
+	model->ms_per_unit = model->ms_per_unit > 0
+		? 0.7 * model->ms_per_unit + 0.3 * sample
+		: sample;
+}
+
+// Repositories of a database opened from a peer, see open_db().
+struct peer_repos {
+	char **orig;  // as configured
+	char **rewritten;  // to the peer, must outlive the database
+	int num;
+};
+
+// libapk caches the indexes fetched from a peer under names derived from the
+// peer's URL. Renames them to the names of the configured repositories, so
+// that offline refreshes find them and the eviction keeps them, and shares
+// them under the configured URLs.
+static void adopt_peer_indexes (const char *cache_dir, const struct peer_repos *peer,
+                                struct cached_index *indexes, size_t num) {
+	for (size_t i = 0; i < num; i++) {
+		struct cached_index *index = &indexes[i];
+
+		for (int j = 0; j < peer->num; j++) {
+			const char *peer_url = repository_url(peer->rewritten[j]);
+			size_t len = strlen(peer_url);
+
+			if (strncmp(index->url, peer_url, len) != 0 || index->url[len] != '/') {
+				continue;
+			}
+			const char *url = repository_url(peer->orig[j]);
+			char file[256], old_path[4096], new_path[4096];
+
+			if (backend_cache_file(url, file, sizeof(file)) < 0) {
+				break;
+			}
+			size_t url_size = strlen(url) + strlen(index->url + len) + 1;
+			char *orig_url = malloc(url_size);
+			char *orig_file = strdup(file);
+			if (!orig_url || !orig_file) {
+				free(orig_url);
+				free(orig_file);
+				break;
+			}
+			snprintf(orig_url, url_size, "%s%s", url, index->url + len);
+			snprintf(old_path, sizeof(old_path), "%s/%s", cache_dir, index->file);
+			snprintf(new_path, sizeof(new_path), "%s/%s", cache_dir, file);
+
+			if (rename(old_path, new_path) < 0) {
+				log_warn("failed to rename %s to %s: %s", old_path, new_path, strerror(errno));
+				free(orig_url);
+				free(orig_file);
+				break;
+			}
+			free(index->url);
+			free(index->file);
+			index->url = orig_url;
+			index->file = orig_file;
+			break;
+		}
+	}
+}
+
+// Marks the cached indexes in use, counts hits and misses, and evicts the
+// least recently used files if the cache is over its limit (see cache.h).
+// The cached indexes are kept in the report for sharing with peers.
+static void update_cache (struct backend_db *db, const struct core_options *opts, const struct peer_repos *peer,
+                          const struct timespec *since, struct report *dest) {
+	int num = backend_cached_indexes(db, &dest->cached);
+	if (num < 0) {
+		log_warn("failed to list the cached indexes");
+		dest->cached = NULL;
+		return;
+	}
+	dest->cached_num = num;
+
+	if (peer->num > 0) {
+		adopt_peer_indexes(opts->cache_dir, peer, dest->cached, num);
+	}
+
+	cache_touch(opts->cache_dir, dest->cached, num, since, &dest->cache);
+
+	if (opts->cache_max_bytes > 0
+			&& cache_evict(opts->cache_dir, opts->cache_max_bytes, dest->cached, num, &dest->cache) < 0) {
+		log_warn("failed to evict from cache %s: %s", opts->cache_dir, strerror(errno));
+	}
+}
+
+// Returns repo with the scheme of its URL replaced by the peer's base URL,
+// e.g. "@edge https://host/path" with "http://peer:8091" gives "@edge
+// http://peer:8091/host/path", or a copy of repo if it's a local path.
+static char *peer_repository (const char *peer, const char *repo) {
+	const char *url = repository_url(repo);
+	const char *sep = strstr(url, "://");
+
+	size_t peer_len = strlen(peer);
+	while (peer_len > 0 && peer[peer_len - 1] == '/') {
+		peer_len--;
+	}
+	if (!sep) {
+		return strdup(repo);
+	}
+	size_t size = (url - repo) + peer_len + strlen(sep + 2) + 1;
+	char *dest = malloc(size);
+	if (dest) {
+		snprintf(dest, size, "%.*s%.*s%s", (int) (url - repo), repo, (int) peer_len, peer, sep + 2);
+	}
+	return dest;
+}
+
+static int copy_strings (char ***dest, char *const *strs, size_t num) {
+	char **copy = calloc(num, sizeof(char *));
+	if (!copy) {
+		return -1;
+	}
+	for (size_t i = 0; i < num; i++) {
+		if (!(copy[i] = strdup(strs[i]))) {
+			free_strings(copy, i);
+			return -1;
+		}
+	}
+	*dest = copy;
+
+	return num;
+}
+
+// Opens the database with the repositories rewritten to each of opts->peers
+// in turn, until one has all the indexes, and with the repositories
+// themselves if none has. If a peer is used, its repositories are kept in
+// peer.
+static int open_db (struct backend_db **dest, const struct core_options *opts, struct report *report,
+                    struct peer_repos *peer) {
+	char **repos = NULL;
+	int num = 0;
+
+	if (opts->peers_num > 0 && !opts->offline) {
+		num = opts->repositories ? copy_strings(&repos, opts->repositories, opts->repositories_num)
+			: read_repositories(&repos, opts->root_dir);
+		if (num < 0) {
+			log_warn("failed to read repositories, not using peers");
+			repos = NULL;
+			num = 0;
+		}
+	}
+	for (size_t p = 0; p < opts->peers_num && num > 0; p++) {
+		char **rewritten = calloc(num, sizeof(char *));
+		if (!rewritten) {
+			break;
+		}
+		for (int i = 0; i < num; i++) {
+			if (!(rewritten[i] = peer_repository(opts->peers[p], repos[i]))) {
+				free_strings(rewritten, i);
+				rewritten = NULL;
+				break;
+			}
+		}
+		if (!rewritten) {
+			break;
+		}
+		struct core_options peer_opts = *opts;
+		peer_opts.repositories = rewritten;
+		peer_opts.repositories_num = num;
+
+		if (backend_open(dest, &peer_opts) == 0) {
+			if (backend_unavailable_repos(*dest) == 0) {
+				report->from_peer = true;
+				*peer = (struct peer_repos) { .orig = repos, .rewritten = rewritten, .num = num };
+				return 0;
+			}
+			backend_close(*dest);
+		}
+		log_info("peer %s doesn't have all the indexes", opts->peers[p]);
+		report->peer_failures++;
+		free_strings(rewritten, num);
+	}
+	free_strings(repos, num);
+
+	return backend_open(dest, opts);
+}
+
+int core_collect (struct report *dest, const struct core_options *opts, const struct report *prev) {
+	int rc = -1;
+	struct backend_db *db = NULL;
+	struct timespec open_time;
+	struct peer_repos peer = {0};
+
+	*dest = (struct report) { .time = time(NULL) };
+	clock_gettime(CLOCK_REALTIME, &open_time);
+
+	if (read_arch(dest->arch, sizeof(dest->arch), opts->root_dir) < 0) {
+		log_err("failed to determine architecture of the root: %s", strerror(errno));
+		goto done;
+	}
+	// libapk names the cached indexes after the repository URL only, so roots
+	// of different architectures can share the cache only in subdirectories.
+	struct core_options arch_opts = *opts;
+	char arch_cache_dir[4096];
+	if (opts->cache_dir) {
+		snprintf(arch_cache_dir, sizeof(arch_cache_dir), "%s/%s", opts->cache_dir, dest->arch);
+		if (mkdir(arch_cache_dir, 0755) < 0 && errno != EEXIST) {
+			log_err("failed to create %s: %s", arch_cache_dir, strerror(errno));
+			goto done;
+		}
+		arch_opts.cache_dir = arch_cache_dir;
+	}
+	opts = &arch_opts;
+
+	profile_phase("db-open");
+	double start = now_ms();
+	if (open_db(&db, opts, dest, &peer) < 0) {
+		goto done;
+	}
+	dest->load_ms = now_ms() - start;
+
+	// Not part of solving, so kept out of solve_ms.
+	backend_db_health(db, &dest->health);
+
+	if (opts->top_n > 0 && (footprint_init(&dest->footprint, opts->top_n) < 0
+			|| backend_footprint(db, &dest->footprint) < 0)) {
+		log_warn("failed to compute the top installed packages by size");
+		footprint_free(&dest->footprint);
+	}
+
+	profile_phase("solve");
+	start = now_ms();
+	if (backend_index_digest(db, dest) < 0) {
+		log_warn("failed to compute digest of the repository indexes");
+	}
+	dest->digest_bytes = digest_resident_bytes(&dest->digest);
+	if (can_reuse(dest, prev)) {
+		dest->mode = REPORT_REUSED;
+		if (copy_upgrades(dest, prev) < 0) {
+			goto done;
+		}
+	} else if (over_budget(dest, opts)) {
+		dest->mode = REPORT_COMPARED;
+		if (backend_compare_versions(db, dest) < 0) {
+			goto done;
+		}
+	} else {
+		dest->mode = REPORT_SOLVED;
+		double solve_start = now_ms();
+		if (backend_find_upgrades(db, dest) < 0) {
+			log_err("failed to find upgradable packages, apk solver returned errors");
+			goto done;
+		}
+		update_model(opts->model, now_ms() - solve_start, solve_units(dest));
+	}
+	dest->solve_ms = now_ms() - start;
+
+	backend_tag_stats(db, dest);
+
+	if (opts->cache_dir) {
+		update_cache(db, opts, &peer, &open_time, dest);
+	}
+
+	if (report_serialize(dest) < 0) {
+		log_err("failed to serialize upgradable packages");
+		goto done;
+	}
+
+	if (read_os_release(&dest->os, opts->root_dir) < 0) {
+		log_warn("failed to read " OS_RELEASE_PATH ": %s", strerror(errno));
+	}
+
+	rc = 0;
+done:
+	profile_phase("cleanup");
+	if (db) {
+		backend_close(db);
+	}
+	free_strings(peer.orig, peer.num);
+	free_strings(peer.rewritten, peer.num);
+	if (rc < 0) {
+		report_free(dest);
+	}
+	return rc;
+}
+
+int report_serialize (struct report *dest) {
+	json_object *array = json_object_new_array();
+
+	for (size_t i = 0; i < dest->upgrades_num; i++) {
+		const struct upgrade *u = &dest->upgrades[i];
+
+		json_object *obj = json_object_new_object();
+		json_object_object_add(obj, "p", json_object_new_string(u->name));
+		json_object_object_add(obj, "o", json_object_new_string(u->origin));
+		json_object_object_add(obj, "v", json_object_new_string(u->old_version));
+		json_object_object_add(obj, "w", json_object_new_string(u->new_version));
+		if (u->abi_removed) {
+			json_object *sonames = json_object_new_array();
+			for (const char *p = u->abi_removed; *p; ) {
+				size_t len = strcspn(p, " ");
+				json_object_array_add(sonames, json_object_new_string_len(p, len));
+				p += len + (p[len] == ' ');
+			}
+			json_object_object_add(obj, "s", sonames);
+			json_object_object_add(obj, "a", json_object_new_int64(u->abi_dependents));
+		}
+		json_object_array_add(array, obj);
+	}
+
+	free(dest->packages_json);
+	dest->packages_json = strdup(json_object_to_json_string_ext(array, JSON_C_TO_STRING_PLAIN));
+	json_object_put(array);
+
+	return dest->packages_json ? 0 : -1;
+}
+
+void report_free (struct report *report) {
+	for (size_t i = 0; i < report->upgrades_num; i++) {
+		struct upgrade *u = &report->upgrades[i];
+		free(u->name);
+		free(u->origin);
+		free(u->old_version);
+		free(u->new_version);
+		free(u->abi_removed);
+	}
+	free(report->upgrades);
+	free(report->packages_json);
+	digest_free(&report->digest);
+	footprint_free(&report->footprint);
+	cached_indexes_free(report->cached, report->cached_num);
+
+	report->upgrades = NULL;
+	report->upgrades_num = 0;
+	report->packages_json = NULL;
+	report->cached = NULL;
+	report->cached_num = 0;
+}
+
+static int write_str (const char *str, FILE *fp) {
+	uint16_t len = str ? strlen(str) : 0;
+
+	return fwrite(&len, sizeof(len), 1, fp) == 1
+		&& fwrite(str ? str : "", 1, len, fp) == len ? 0 : -1;
+}
+
+static char *read_str (FILE *fp) {
+	uint16_t len = 0;
+	if (fread(&len, sizeof(len), 1, fp) != 1) {
+		return NULL;
+	}
+	char *str = malloc(len + 1);
+	if (str && fread(str, 1, len, fp) != len) {
+		free(str);
+		return NULL;
+	}
+	if (str) {
+		str[len] = '\0';
+	}
+	return str;
+}
+
+int report_write_snapshot (const struct report *report, FILE *fp) {
+	int64_t time = report->time;
+	uint32_t count = report->upgrades_num;
+
+	if (fwrite(SNAPSHOT_MAGIC, 1, strlen(SNAPSHOT_MAGIC), fp) != strlen(SNAPSHOT_MAGIC)
+			|| fwrite(&time, sizeof(time), 1, fp) != 1
+			|| write_str(report->os.id, fp) < 0
+			|| write_str(report->os.version_id, fp) < 0
+			|| write_str(report->arch, fp) < 0
+			|| fwrite(&count, sizeof(count), 1, fp) != 1) {
+		return -1;
+	}
+	for (size_t i = 0; i < report->upgrades_num; i++) {
+		const struct upgrade *u = &report->upgrades[i];
+		if (write_str(u->name, fp) < 0
+				|| write_str(u->origin, fp) < 0
+				|| write_str(u->old_version, fp) < 0
+				|| write_str(u->new_version, fp) < 0
+				|| write_str(u->abi_removed, fp) < 0
+				|| fwrite(&u->abi_dependents, sizeof(u->abi_dependents), 1, fp) != 1) {
+			return -1;
+		}
+	}
+	return fflush(fp) == 0 ? 0 : -1;
+}
+
+int report_read_snapshot (struct report *dest, FILE *fp) {
+	char magic[sizeof(SNAPSHOT_MAGIC) - 1];
+	int64_t time = 0;
+	uint32_t count = 0;
+	char *os_id = NULL, *os_version = NULL, *arch = NULL;
+
+	*dest = (struct report) {0};
+
+	if (fread(magic, 1, sizeof(magic), fp) != sizeof(magic)
+			|| memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) != 0
+			|| fread(&time, sizeof(time), 1, fp) != 1
+			|| !(os_id = read_str(fp))
+			|| !(os_version = read_str(fp))
+			|| !(arch = read_str(fp))
+			|| fread(&count, sizeof(count), 1, fp) != 1) {
+		goto fail;
+	}
+	dest->time = time;
+	dest->mode = REPORT_RESTORED;
+	snprintf(dest->os.id, sizeof(dest->os.id), "%s", os_id);
+	snprintf(dest->os.version_id, sizeof(dest->os.version_id), "%s", os_version);
+	snprintf(dest->arch, sizeof(dest->arch), "%s", arch);
+
+	if (count > 0 && !(dest->upgrades = calloc(count, sizeof(struct upgrade)))) {
+		goto fail;
+	}
+	for (; dest->upgrades_num < count; dest->upgrades_num++) {
+		struct upgrade *u = &dest->upgrades[dest->upgrades_num];
+		if (!(u->name = read_str(fp))
+				|| !(u->origin = read_str(fp))
+				|| !(u->old_version = read_str(fp))
+				|| !(u->new_version = read_str(fp))
+				|| !(u->abi_removed = read_str(fp))
+				|| fread(&u->abi_dependents, sizeof(u->abi_dependents), 1, fp) != 1) {
+			dest->upgrades_num++;  // free the partially read entry too
+			goto fail;
+		}
+		if (*u->abi_removed == '\0') {
+			free(u->abi_removed);
+			u->abi_removed = NULL;
+		}
+	}
+	free(os_id);
+	free(os_version);
+	free(arch);
+
+	return report_serialize(dest);
+fail:
+	free(os_id);
+	free(os_version);
+	free(arch);
+	report_free(dest);
+
+	return -1;
+}
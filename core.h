@@ -0,0 +1,198 @@
+// SPDX-FileCopyrightText: 2022-present Jakub Jirutka <jakub@jirutka.cz>
+// SPDX-License-Identifier: GPL-2.0-or-later
+//
+// The plugin's core: opens the apk database, finds upgradable packages and
+// serializes the result. It doesn't depend on collectd, it's shared by the
+// plugin (apk.c) and the standalone probe (probe.c).
+#ifndef CORE_H
+#define CORE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <syslog.h>
+#include <time.h>
+
+#include "cache.h"
+#include "delta.h"
+#include "footprint.h"
+
+#define PLUGIN_NAME "apk"
+
+#ifndef PLUGIN_VERSION
+  #define PLUGIN_VERSION "0.2.0"
+#endif
+
+#define OS_RELEASE_PATH "/etc/os-release"
+
+#define log_info(...) core_log(LOG_INFO, __VA_ARGS__)
+#define log_warn(...) core_log(LOG_WARNING, __VA_ARGS__)
+#define log_err(...) core_log(LOG_ERR, __VA_ARGS__)
+
+#ifndef min
+  #define min(a, b) ((a) < (b) ? (a) : (b))
+#endif
+
+#ifndef max
+  #define max(a, b) ((a) > (b) ? (a) : (b))
+#endif
+
+#ifndef STATIC_ARRAY_SIZE
+  #define STATIC_ARRAY_SIZE(a) (sizeof(a) / sizeof(*(a)))
+#endif
+
+#define UNUSED __attribute__((unused))
+
+#ifdef ALLOC_PROFILE
+  // Provided by bench/allocstat.so when preloaded by the benchmark driver.
+  extern void allocstat_phase (const char *name) __attribute__((weak));
+  #define profile_phase(name) do { if (allocstat_phase) allocstat_phase(name); } while (0)
+#else
+  #define profile_phase(name)
+#endif
+
+#define FNV1A_INIT 0xcbf29ce484222325ull
+
+// 64-bit FNV-1a hash, pass FNV1A_INIT or the previous hash as seed.
+static inline uint64_t fnv1a (const void *data, size_t len, uint64_t seed) {
+	const unsigned char *p = data;
+	uint64_t hash = seed;
+
+	for (size_t i = 0; i < len; i++) {
+		hash = (hash ^ p[i]) * 0x100000001b3ull;
+	}
+	return hash;
+}
+
+// Cost of the solver learned from past solves, see core_collect().
+struct solve_model {
+	double ms_per_unit;  // 0 if unknown yet
+	unsigned compared_num;  // refreshes over the budget since the last solve
+};
+
+struct core_options {
+	const char *root_dir;  // NULL for "/"
+	const char *cache_dir;  // NULL to fetch indexes in-memory on every open; per arch in subdirectories
+	uint64_t cache_max_bytes;  // size limit of cache_dir, 0 for unlimited
+	char *const *peers;  // base URLs of peers to fetch indexes from first (see share.h)
+	size_t peers_num;
+	bool allow_untrusted;
+	bool offline;  // use only cached indexes (requires cache_dir)
+	double solve_budget_ms;  // 0 for unlimited
+	int timeout;  // of fetching indexes in seconds, 0 for apk's default
+	char *const *repositories;  // if not NULL, used instead of etc/apk/repositories
+	size_t repositories_num;
+	size_t top_n;  // of packages and origins by installed size, 0 to skip
+	struct solve_model *model;  // updated after each solve, may be NULL
+};
+
+enum report_mode {
+	REPORT_SOLVED,  // by the solver
+	REPORT_REUSED,  // from the previous report, nothing relevant changed
+	REPORT_COMPARED,  // by comparing versions only, the solver was over budget
+	REPORT_RESTORED,  // read from the snapshot, not evaluated in this run
+};
+
+struct os_release {
+	char id[64];
+	char version_id[64];
+};
+
+struct upgrade {
+	char *name;
+	char *origin;
+	char *old_version;
+	char *new_version;
+	char *abi_removed;  // so: names the new version doesn't provide, space-separated, or NULL
+	uint32_t abi_dependents;  // installed packages depending on them (see abi.h)
+};
+
+// State of the installed database that needs attention, e.g. after an
+// interrupted upgrade.
+struct db_health {
+	bool known;  // false if not computed (e.g. the report comes from a snapshot)
+	size_t broken_files;  // packages with files that failed to install
+	size_t broken_scripts;  // packages with a failed install script
+	size_t broken_xattrs;  // packages with xattrs that failed to apply
+	size_t missing_world;  // world entries not satisfied by any installed package
+};
+
+#define REPORT_MAX_TAGS 32
+
+// Packages attributed to a repository tag they are pinned to (pkg@tag).
+struct tag_stats {
+	char name[64];  // "untagged" for packages not pinned to a tag
+	size_t installed;
+	size_t upgradable;
+};
+
+struct report {
+	time_t time;  // when the report was collected
+	struct os_release os;
+	char arch[64];  // of the root
+	size_t upgrades_num;
+	struct upgrade *upgrades;
+	char *packages_json;  // upgrades serialized as a JSON array
+	double load_ms;  // time spent opening the database
+	double solve_ms;  // time spent in the solver
+	uint64_t index_fingerprint;  // of the loaded repository indexes
+	struct index_digest digest;  // of the loaded indexes, empty if unknown
+	size_t digest_bytes;  // heap memory held by digest
+	size_t index_changed;  // packages changed since the previous report
+	enum report_mode mode;
+	struct footprint footprint;  // top packages and origins, empty if not computed
+	struct db_health health;
+	struct tag_stats tags[REPORT_MAX_TAGS];
+	size_t tags_num;  // 0 if not computed
+	struct cache_stats cache;  // of this refresh, zero if there's no cache_dir
+	struct cached_index *cached;  // indexes in cache_dir, NULL if not known
+	size_t cached_num;
+	bool from_peer;  // the indexes were fetched from a peer
+	size_t peer_failures;  // peers tried that didn't have all the indexes
+};
+
+// Logs a message; implemented by the frontend (the plugin or the probe).
+void core_log (int level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+int read_os_release (struct os_release *dest, const char *root_dir);
+
+// Reads the architecture of root_dir (etc/apk/arch), or of the host (by apk's
+// name, e.g. x86 for i686) if it's not set, into dest. Returns 0 on success,
+// or -1 on error.
+int read_arch (char *dest, size_t size, const char *root_dir);
+
+void free_strings (char **strs, size_t num);
+
+// Opens the apk database, runs the solver and fills the report (see
+// backend.h). If opts->peers are given, the indexes are fetched from the
+// first of them that has all of them, and from the repositories only if none
+// has. If prev is given and none of the index entries that changed since then
+// touches the installed packages, its upgrades are reused instead of solving.
+// If the solve is predicted to take longer than opts->solve_budget_ms, only
+// versions of the installed packages are compared with the indexes. Returns 0
+// on success, or -1 on error (the error is logged).
+int core_collect (struct report *dest, const struct core_options *opts, const struct report *prev);
+
+// Serializes the report's upgrades into dest->packages_json.
+int report_serialize (struct report *dest);
+
+void report_free (struct report *report);
+
+// Returns "solve", "reuse", "compare" or "restore".
+static inline const char *report_mode_name (enum report_mode mode) {
+	switch (mode) {
+		case REPORT_SOLVED: return "solve";
+		case REPORT_REUSED: return "reuse";
+		case REPORT_COMPARED: return "compare";
+		case REPORT_RESTORED: return "restore";
+	}
+	return "unknown";
+}
+
+// Binary snapshot of the report; it's meant to be read by the same build on
+// the same host, so it uses native byte order.
+int report_write_snapshot (const struct report *report, FILE *fp);
+int report_read_snapshot (struct report *dest, FILE *fp);
+
+#endif
@@ -0,0 +1,45 @@
+// SPDX-FileCopyrightText: 2022-present Jakub Jirutka <jakub@jirutka.cz>
+// SPDX-License-Identifier: GPL-2.0-or-later
+//
+// Entry point of apk-core.so, see lazy.h.
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "core.h"
+#include "lazy.h"
+
+static core_log_fn log_fn = NULL;
+
+void core_log (int level, const char *format, ...) {
+	va_list ap;
+	va_start(ap, format);
+
+	char msg[1024];
+	vsnprintf(msg, sizeof(msg), format, ap);
+	va_end(ap);
+
+	if (log_fn) {
+		log_fn(level, msg);
+	}
+}
+
+static const struct core_ops ops = {
+	.collect = core_collect,
+	.report_free = report_free,
+	.read_snapshot = report_read_snapshot,
+	.write_snapshot = report_write_snapshot,
+};
+
+const struct core_ops *core_entry (const char *version, size_t report_size, size_t options_size,
+                                   core_log_fn log) {
+	log_fn = log;
+
+	if (strcmp(version, PLUGIN_VERSION) != 0 || report_size != sizeof(struct report)
+			|| options_size != sizeof(struct core_options)) {
+		log_err("%s %s doesn't match %s.so %s, reinstall the plugin", CORE_LIB_NAME, PLUGIN_VERSION,
+		        PLUGIN_NAME, version);
+		return NULL;
+	}
+	return &ops;
+}
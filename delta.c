@@ -0,0 +1,203 @@
+// SPDX-FileCopyrightText: 2022-present Jakub Jirutka <jakub@jirutka.cz>
+// SPDX-License-Identifier: GPL-2.0-or-later
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "core.h"
+#include "delta.h"
+
+static uint64_t name_hash (const char *name, size_t len) {
+	uint64_t hash = fnv1a(name, len, FNV1A_INIT);
+
+	return hash ? hash : 1;  // 0 marks an empty slot
+}
+
+static uint32_t entry_name_hash (const char *name, size_t len) {
+	uint64_t hash = fnv1a(name, len, FNV1A_INIT);
+
+	return (uint32_t) (hash ^ (hash >> 32));
+}
+
+static uint64_t entry_hash (const struct digest_entry *entry) {
+	return ((uint64_t) entry->hash_hi << 32 | entry->hash_lo) >> 1;
+}
+
+static bool entry_relevant (const struct digest_entry *entry) {
+	return entry->hash_lo & 1;
+}
+
+static int closure_grow (struct index_digest *digest) {
+	size_t cap = digest->closure_cap ? digest->closure_cap * 2 : 1024;
+	uint64_t *closure = calloc(cap, sizeof(uint64_t));
+	if (!closure) {
+		return -1;
+	}
+	for (size_t i = 0; i < digest->closure_cap; i++) {
+		uint64_t hash = digest->closure[i];
+		if (hash) {
+			size_t j = hash & (cap - 1);
+			while (closure[j]) {
+				j = (j + 1) & (cap - 1);
+			}
+			closure[j] = hash;
+		}
+	}
+	free(digest->closure);
+	digest->closure = closure;
+	digest->closure_cap = cap;
+
+	return 0;
+}
+
+int digest_add_closure (struct index_digest *digest, const char *name, size_t len) {
+	// Keep the load factor under 1/2.
+	if (digest->closure_num * 2 >= digest->closure_cap && closure_grow(digest) < 0) {
+		return -1;
+	}
+	uint64_t hash = name_hash(name, len);
+	size_t mask = digest->closure_cap - 1;
+	size_t i = hash & mask;
+
+	while (digest->closure[i]) {
+		if (digest->closure[i] == hash) {
+			return 0;
+		}
+		i = (i + 1) & mask;
+	}
+	digest->closure[i] = hash;
+	digest->closure_num++;
+
+	return 0;
+}
+
+bool digest_in_closure (const struct index_digest *digest, const char *name, size_t len) {
+	if (digest->closure_cap == 0) {
+		return false;
+	}
+	uint64_t hash = name_hash(name, len);
+	size_t mask = digest->closure_cap - 1;
+
+	for (size_t i = hash & mask; digest->closure[i]; i = (i + 1) & mask) {
+		if (digest->closure[i] == hash) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void digest_add_local (struct index_digest *digest, const void *data, size_t len) {
+	digest->local_hash += fnv1a(data, len, FNV1A_INIT);
+}
+
+int digest_add_entry (struct index_digest *digest, const char *name, size_t name_len,
+                      const char *version, size_t version_len,
+                      const void *checksum, size_t checksum_len, bool relevant) {
+	if (digest->entries_num == digest->entries_cap) {
+		size_t cap = digest->entries_cap ? digest->entries_cap * 2 : 4096;
+		struct digest_entry *entries = realloc(digest->entries, cap * sizeof(*entries));
+		if (!entries) {
+			return -1;
+		}
+		digest->entries = entries;
+		digest->entries_cap = cap;
+	}
+	uint64_t hash = fnv1a(name, name_len, FNV1A_INIT);
+	hash = fnv1a(version, version_len, hash);
+	hash = fnv1a(checksum, checksum_len, hash);
+
+	hash = (hash & ~1ull) | relevant;
+
+	digest->entries[digest->entries_num++] = (struct digest_entry) {
+		.name = entry_name_hash(name, name_len),
+		.hash_lo = (uint32_t) hash,
+		.hash_hi = (uint32_t) (hash >> 32),
+	};
+	return 0;
+}
+
+static int cmp_entry (const void *a, const void *b) {
+	const struct digest_entry *x = a, *y = b;
+
+	if (x->name != y->name) {
+		return x->name < y->name ? -1 : 1;
+	}
+	return (entry_hash(x) > entry_hash(y)) - (entry_hash(x) < entry_hash(y));
+}
+
+void digest_finish (struct index_digest *digest) {
+	qsort(digest->entries, digest->entries_num, sizeof(struct digest_entry), cmp_entry);
+
+	if (digest->entries_num > 0 && digest->entries_num < digest->entries_cap) {
+		struct digest_entry *entries = realloc(digest->entries, digest->entries_num * sizeof(*entries));
+		if (entries) {
+			digest->entries = entries;
+			digest->entries_cap = digest->entries_num;
+		}
+	}
+	// Only needed while adding entries; closure_num stays as a size hint.
+	free(digest->closure);
+	digest->closure = NULL;
+	digest->closure_cap = 0;
+}
+
+size_t digest_resident_bytes (const struct index_digest *digest) {
+	return digest->entries_cap * sizeof(struct digest_entry) + digest->closure_cap * sizeof(uint64_t);
+}
+
+void digest_free (struct index_digest *digest) {
+	free(digest->entries);
+	free(digest->closure);
+	*digest = (struct index_digest) {0};
+}
+
+// Returns the end of the run of entries with the same name starting at i.
+static size_t name_run_end (const struct index_digest *digest, size_t i) {
+	size_t end = i;
+
+	while (end < digest->entries_num && digest->entries[end].name == digest->entries[i].name) {
+		end++;
+	}
+	return end;
+}
+
+static bool any_relevant (const struct digest_entry *entries, size_t from, size_t to) {
+	for (size_t i = from; i < to; i++) {
+		if (entry_relevant(&entries[i])) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool digest_compare (const struct index_digest *old, const struct index_digest *new,
+                     struct index_delta *dest) {
+	*dest = (struct index_delta) {0};
+
+	// Both are sorted by name, then hash; walk them by runs of the same name.
+	size_t i = 0, j = 0;
+	while (i < old->entries_num || j < new->entries_num) {
+		uint64_t name = i == old->entries_num ? new->entries[j].name
+			: j == new->entries_num ? old->entries[i].name
+			: min(old->entries[i].name, new->entries[j].name);
+
+		size_t i_end = i < old->entries_num && old->entries[i].name == name ? name_run_end(old, i) : i;
+		size_t j_end = j < new->entries_num && new->entries[j].name == name ? name_run_end(new, j) : j;
+
+		bool same = i_end - i == j_end - j;
+		for (size_t k = 0; same && k < i_end - i; k++) {
+			same = entry_hash(&old->entries[i + k]) == entry_hash(&new->entries[j + k]);
+		}
+		if (!same) {
+			dest->changed++;
+			if (any_relevant(old->entries, i, i_end) || any_relevant(new->entries, j, j_end)) {
+				dest->relevant++;
+			}
+		}
+		i = i_end;
+		j = j_end;
+	}
+	return old->local_hash == new->local_hash;
+}
@@ -0,0 +1,72 @@
+// SPDX-FileCopyrightText: 2022-present Jakub Jirutka <jakub@jirutka.cz>
+// SPDX-License-Identifier: GPL-2.0-or-later
+//
+// Digest of the loaded repository indexes, used to find out what changed
+// between two refreshes and whether the change can affect the upgradable
+// packages at all. It contains a hash of every available package (name,
+// version and checksum) and the names of installed packages and their
+// dependencies (the installed closure).
+//
+// The digest of the last refresh stays resident between refreshes, so it's
+// kept compact: 12 bytes per package, and the closure is dropped once the
+// entries are finished. Name hashes are only 32-bit; a collision merges the
+// runs of two names, which can only make a change look relevant, never hide
+// one.
+#ifndef DELTA_H
+#define DELTA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct digest_entry {
+	uint32_t name;  // hash of the name
+	// Hash of the name, version and checksum (split to avoid padding). The
+	// lowest bit is set if the package or something it provides is in the
+	// closure.
+	uint32_t hash_lo, hash_hi;
+};
+
+struct index_digest {
+	struct digest_entry *entries;
+	size_t entries_num, entries_cap;
+	uint64_t *closure;  // open addressing set of name hashes, 0 is empty; NULL when finished
+	size_t closure_num, closure_cap;
+	uint64_t local_hash;  // installed packages and world
+};
+
+struct index_delta {
+	size_t changed;  // names with added, removed or modified packages
+	size_t relevant;  // of them those touching the installed closure
+};
+
+// Adds a name of an installed package or its dependency to the closure.
+// All names must be added before the entries.
+int digest_add_closure (struct index_digest *digest, const char *name, size_t len);
+
+bool digest_in_closure (const struct index_digest *digest, const char *name, size_t len);
+
+// Mixes data describing the local state (an installed package and its
+// version, or a world constraint) into local_hash, regardless of order.
+void digest_add_local (struct index_digest *digest, const void *data, size_t len);
+
+int digest_add_entry (struct index_digest *digest, const char *name, size_t name_len,
+                      const char *version, size_t version_len,
+                      const void *checksum, size_t checksum_len, bool relevant);
+
+// Must be called after all entries have been added. Sorts the entries,
+// trims them and frees the closure.
+void digest_finish (struct index_digest *digest);
+
+// Returns the heap memory held by the digest.
+size_t digest_resident_bytes (const struct index_digest *digest);
+
+void digest_free (struct index_digest *digest);
+
+// Compares two finished digests and fills dest. Returns false if the delta
+// doesn't tell whether the upgrades can change, because the installed
+// packages or world differ.
+bool digest_compare (const struct index_digest *old, const struct index_digest *new,
+                     struct index_delta *dest);
+
+#endif
@@ -0,0 +1,165 @@
+// SPDX-FileCopyrightText: 2022-present Jakub Jirutka <jakub@jirutka.cz>
+// SPDX-License-Identifier: GPL-2.0-or-later
+#define _POSIX_C_SOURCE 200809L
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "core.h"
+#include "footprint.h"
+
+static void swap (struct footprint_entry *a, struct footprint_entry *b) {
+	struct footprint_entry tmp = *a;
+	*a = *b;
+	*b = tmp;
+}
+
+static void sift_down (struct footprint_entry *heap, size_t num, size_t i) {
+	for (;;) {
+		size_t smallest = i, l = 2 * i + 1, r = 2 * i + 2;
+
+		if (l < num && heap[l].size < heap[smallest].size) {
+			smallest = l;
+		}
+		if (r < num && heap[r].size < heap[smallest].size) {
+			smallest = r;
+		}
+		if (smallest == i) {
+			return;
+		}
+		swap(&heap[i], &heap[smallest]);
+		i = smallest;
+	}
+}
+
+// Offers the entry to the min-heap of at most n entries, taking ownership of
+// name (it's freed if the entry doesn't make it).
+static void heap_offer (struct footprint_entry *heap, size_t *num, size_t n, char *name, uint64_t size) {
+	if (*num < n) {
+		size_t i = (*num)++;
+		heap[i] = (struct footprint_entry) { name, size };
+		for (; i > 0 && heap[(i - 1) / 2].size > heap[i].size; i = (i - 1) / 2) {
+			swap(&heap[i], &heap[(i - 1) / 2]);
+		}
+	} else if (n > 0 && size > heap[0].size) {
+		free(heap[0].name);
+		heap[0] = (struct footprint_entry) { name, size };
+		sift_down(heap, *num, 0);
+	} else {
+		free(name);
+	}
+}
+
+static int cmp_size_desc (const void *a, const void *b) {
+	const struct footprint_entry *x = a, *y = b;
+	return (x->size < y->size) - (x->size > y->size);
+}
+
+int footprint_init (struct footprint *fp, size_t n) {
+	*fp = (struct footprint) { .n = n };
+
+	if (!(fp->packages = calloc(n, sizeof(*fp->packages)))
+			|| !(fp->origins = calloc(n, sizeof(*fp->origins)))) {
+		footprint_free(fp);
+		return -1;
+	}
+	return 0;
+}
+
+static int sums_grow (struct footprint *fp) {
+	size_t cap = fp->sums_cap ? fp->sums_cap * 2 : 512;
+	struct origin_sum *sums = calloc(cap, sizeof(*sums));
+	if (!sums) {
+		return -1;
+	}
+	for (size_t i = 0; i < fp->sums_cap; i++) {
+		if (fp->sums[i].hash) {
+			size_t j = fp->sums[i].hash & (cap - 1);
+			while (sums[j].hash) {
+				j = (j + 1) & (cap - 1);
+			}
+			sums[j] = fp->sums[i];
+		}
+	}
+	free(fp->sums);
+	fp->sums = sums;
+	fp->sums_cap = cap;
+
+	return 0;
+}
+
+static int add_origin (struct footprint *fp, const char *origin, size_t len, uint64_t size) {
+	// Keep the load factor under 1/2.
+	if (fp->sums_num * 2 >= fp->sums_cap && sums_grow(fp) < 0) {
+		return -1;
+	}
+	uint64_t hash = fnv1a(origin, len, FNV1A_INIT);
+	hash = hash ? hash : 1;
+
+	size_t i = hash & (fp->sums_cap - 1);
+	while (fp->sums[i].hash && !(fp->sums[i].hash == hash
+			&& strncmp(fp->sums[i].origin, origin, len) == 0 && fp->sums[i].origin[len] == '\0')) {
+		i = (i + 1) & (fp->sums_cap - 1);
+	}
+	struct origin_sum *sum = &fp->sums[i];
+	if (!sum->hash) {
+		if (!(sum->origin = strndup(origin, len))) {
+			return -1;
+		}
+		sum->hash = hash;
+		fp->sums_num++;
+	}
+	sum->size += size;
+
+	return 0;
+}
+
+int footprint_add (struct footprint *fp, const char *name, const char *origin, size_t origin_len,
+                   uint64_t size) {
+	if (add_origin(fp, origin, origin_len, size) < 0) {
+		return -1;
+	}
+	// Don't copy the name of a package that wouldn't make it anyway.
+	if (fp->packages_num == fp->n && (fp->n == 0 || size <= fp->packages[0].size)) {
+		return 0;
+	}
+	char *copy = strdup(name);
+	if (!copy) {
+		return -1;
+	}
+	heap_offer(fp->packages, &fp->packages_num, fp->n, copy, size);
+
+	return 0;
+}
+
+void footprint_finish (struct footprint *fp) {
+	for (size_t i = 0; i < fp->sums_cap; i++) {
+		if (fp->sums[i].hash) {
+			heap_offer(fp->origins, &fp->origins_num, fp->n, fp->sums[i].origin, fp->sums[i].size);
+		}
+	}
+	free(fp->sums);
+	fp->sums = NULL;
+	fp->sums_num = fp->sums_cap = 0;
+
+	qsort(fp->packages, fp->packages_num, sizeof(*fp->packages), cmp_size_desc);
+	qsort(fp->origins, fp->origins_num, sizeof(*fp->origins), cmp_size_desc);
+}
+
+void footprint_free (struct footprint *fp) {
+	for (size_t i = 0; i < fp->packages_num; i++) {
+		free(fp->packages[i].name);
+	}
+	for (size_t i = 0; i < fp->origins_num; i++) {
+		free(fp->origins[i].name);
+	}
+	for (size_t i = 0; i < fp->sums_cap; i++) {
+		free(fp->sums[i].origin);
+	}
+	free(fp->packages);
+	free(fp->origins);
+	free(fp->sums);
+	*fp = (struct footprint) {0};
+}
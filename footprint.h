@@ -0,0 +1,45 @@
+// SPDX-FileCopyrightText: 2022-present Jakub Jirutka <jakub@jirutka.cz>
+// SPDX-License-Identifier: GPL-2.0-or-later
+//
+// Top N installed packages and origins by installed size. Packages are kept
+// in a bounded min-heap while the installed packages are walked, sizes of
+// origins are summed in a hash map and put through the same heap at the end,
+// so it costs O(n log N) and only the N results are sorted.
+#ifndef FOOTPRINT_H
+#define FOOTPRINT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct footprint_entry {
+	char *name;
+	uint64_t size;  // in bytes
+};
+
+struct origin_sum {
+	uint64_t hash;  // of the origin, 0 is empty
+	char *origin;
+	uint64_t size;
+};
+
+struct footprint {
+	size_t n;
+	struct footprint_entry *packages;  // largest first after footprint_finish()
+	size_t packages_num;
+	struct footprint_entry *origins;  // largest first after footprint_finish()
+	size_t origins_num;
+	struct origin_sum *sums;  // open addressing, only until footprint_finish()
+	size_t sums_num, sums_cap;
+};
+
+int footprint_init (struct footprint *fp, size_t n);
+
+int footprint_add (struct footprint *fp, const char *name, const char *origin, size_t origin_len,
+                   uint64_t size);
+
+// Must be called after all packages have been added.
+void footprint_finish (struct footprint *fp);
+
+void footprint_free (struct footprint *fp);
+
+#endif
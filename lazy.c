@@ -0,0 +1,62 @@
+// SPDX-FileCopyrightText: 2022-present Jakub Jirutka <jakub@jirutka.cz>
+// SPDX-License-Identifier: GPL-2.0-or-later
+#define _GNU_SOURCE  // dladdr
+
+#include <dlfcn.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "core.h"
+#include "lazy.h"
+
+static const struct core_ops *ops = NULL;
+
+// collectd loads apk.so by its absolute path in PluginDir, apk-core.so is
+// installed next to it.
+static void core_lib_path (char *dest, size_t size) {
+	Dl_info info = {0};
+	const char *slash = NULL;
+
+	if (dladdr(&ops, &info) && info.dli_fname) {
+		slash = strrchr(info.dli_fname, '/');
+	}
+	if (slash) {
+		snprintf(dest, size, "%.*s/%s", (int) (slash - info.dli_fname), info.dli_fname, CORE_LIB_NAME);
+	} else {
+		snprintf(dest, size, "%s", CORE_LIB_NAME);
+	}
+}
+
+const struct core_ops *core_load (core_log_fn log) {
+	if (ops) {
+		return ops;
+	}
+	char path[4096];
+	core_lib_path(path, sizeof(path));
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+	if (!handle) {
+		log_err("failed to load %s: %s", path, dlerror());
+		return NULL;
+	}
+	core_entry_fn entry;
+	*(void **) &entry = dlsym(handle, "core_entry");
+	if (!entry) {
+		log_err("%s has no core_entry", path);
+		dlclose(handle);
+		return NULL;
+	}
+	if (!(ops = entry(PLUGIN_VERSION, sizeof(struct report), sizeof(struct core_options), log))) {
+		dlclose(handle);  // the mismatch is logged by apk-core.so
+		return NULL;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	log_info("loaded %s in %.1f ms", path,
+	         (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6);
+
+	return ops;
+}
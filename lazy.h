@@ -0,0 +1,41 @@
+// SPDX-FileCopyrightText: 2022-present Jakub Jirutka <jakub@jirutka.cz>
+// SPDX-License-Identifier: GPL-2.0-or-later
+//
+// The plugin is split in two shared objects: apk.so with the collectd glue,
+// which is cheap to load, and apk-core.so with the core and the backend,
+// which links libapk and json-c. apk.so loads apk-core.so on first use, so
+// collectd doesn't resolve and relocate the heavy libraries at startup.
+#ifndef LAZY_H
+#define LAZY_H
+
+#include <stdio.h>
+
+#include "core.h"
+
+#define CORE_LIB_NAME PLUGIN_NAME "-core.so"
+
+// Receives a formatted message from core_log() of apk-core.so.
+typedef void (*core_log_fn)(int level, const char *msg);
+
+// Entry points of apk-core.so, see core.h for their description.
+struct core_ops {
+	int (*collect)(struct report *dest, const struct core_options *opts, const struct report *prev);
+	void (*report_free)(struct report *report);
+	int (*read_snapshot)(struct report *dest, FILE *fp);
+	int (*write_snapshot)(const struct report *report, FILE *fp);
+};
+
+// Exported by apk-core.so. The caller passes its PLUGIN_VERSION and the
+// sizes of the structs it shares with the core; if they differ from those
+// apk-core.so was built with, the mismatch is logged and NULL is returned.
+const struct core_ops *core_entry (const char *version, size_t report_size, size_t options_size,
+                                   core_log_fn log);
+typedef const struct core_ops *(*core_entry_fn)(const char *version, size_t report_size,
+                                                size_t options_size, core_log_fn log);
+
+// Loads apk-core.so from the directory of apk.so, if not loaded yet. It's
+// never unloaded. Returns its entry points, or NULL on error (the error is
+// logged). Not thread-safe, the plugin calls it only while refreshing.
+const struct core_ops *core_load (core_log_fn log);
+
+#endif
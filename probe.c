@@ -0,0 +1,155 @@
+// SPDX-FileCopyrightText: 2022-present Jakub Jirutka <jakub@jirutka.cz>
+// SPDX-License-Identifier: GPL-2.0-or-later
+//
+// Standalone probe: runs the same core as the collectd plugin and prints the
+// result, so it can be used from scripts and under perf, valgrind etc.
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "backend.h"
+#include "core.h"
+
+#define PROG_NAME "apk-probe"
+
+static int verbosity = LOG_WARNING;
+
+void core_log (int level, const char *format, ...) {
+	if (level > verbosity) {
+		return;
+	}
+	va_list ap;
+	va_start(ap, format);
+
+	fprintf(stderr, PROG_NAME ": ");
+	vfprintf(stderr, format, ap);
+	fputc('\n', stderr);
+
+	va_end(ap);
+}
+
+static void print_json (const struct report *report, FILE *out) {
+	// The strings are not escaped, os-release values don't contain quotes.
+	fprintf(out, "{\"time\":%lld,\"os-id\":\"%s\",\"os-version\":\"%s\",\"arch\":\"%s\","
+	             "\"backend\":\"%s\",\"load_ms\":%.3f,\"solve_ms\":%.3f,"
+	             "\"mode\":\"%s\",\"count\":%zu,\"packages\":%s}\n",
+	        (long long) report->time, report->os.id, report->os.version_id, report->arch,
+	        backend_name, report->load_ms, report->solve_ms, report_mode_name(report->mode),
+	        report->upgrades_num, report->packages_json);
+}
+
+static int cmp_double (const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+// Collects the report iterations times and sets load_ms and solve_ms of the
+// last one to the median of all runs.
+static int collect_repeatedly (struct report *dest, const struct core_options *opts, int iterations) {
+	double *load = calloc(iterations, sizeof(double));
+	double *solve = calloc(iterations, sizeof(double));
+	int rc = -1;
+
+	if (!load || !solve) {
+		goto done;
+	}
+	for (int i = 0; i < iterations; i++) {
+		if (i > 0) {
+			report_free(dest);
+		}
+		if (core_collect(dest, opts, NULL) < 0) {
+			goto done;
+		}
+		load[i] = dest->load_ms;
+		solve[i] = dest->solve_ms;
+	}
+	qsort(load, iterations, sizeof(double), cmp_double);
+	qsort(solve, iterations, sizeof(double), cmp_double);
+	dest->load_ms = load[iterations / 2];
+	dest->solve_ms = solve[iterations / 2];
+
+	rc = 0;
+done:
+	free(load);
+	free(solve);
+
+	return rc;
+}
+
+static void usage (FILE *out) {
+	fprintf(out,
+		"Usage: " PROG_NAME " [-Uv] [-r ROOT] [-n ITERATIONS] [-f json|snapshot]\n"
+		"       " PROG_NAME " -s SNAPSHOT\n"
+		"\n"
+		"Find upgradable packages like the collectd apk plugin does and print the\n"
+		"result as JSON, or as a binary snapshot (-f snapshot). With -s, read\n"
+		"a snapshot and print it as JSON.\n"
+		"\n"
+		"Options:\n"
+		"  -r ROOT      Root directory of the apk database (default is /).\n"
+		"  -U           Allow untrusted repository indexes.\n"
+		"  -f FORMAT    Output format: json (default) or snapshot.\n"
+		"  -n NUM       Collect NUM times and report median load and solve time.\n"
+		"  -s SNAPSHOT  Read the result from SNAPSHOT instead of collecting it.\n"
+		"  -v           Be verbose.\n"
+		"  -V           Print version and exit.\n");
+}
+
+int main (int argc, char **argv) {
+	struct core_options opts = {0};
+	const char *format = "json";
+	const char *snapshot_path = NULL;
+	int iterations = 1;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "f:hn:r:s:UvV")) != -1) {
+		switch (opt) {
+			case 'f': format = optarg; break;
+			case 'n': iterations = atoi(optarg); break;
+			case 'r': opts.root_dir = optarg; break;
+			case 's': snapshot_path = optarg; break;
+			case 'U': opts.allow_untrusted = true; break;
+			case 'v': verbosity = LOG_DEBUG; break;
+			case 'V': printf(PROG_NAME " " PLUGIN_VERSION "\n"); return 0;
+			case 'h': usage(stdout); return 0;
+			default: usage(stderr); return 1;
+		}
+	}
+	if (optind != argc || iterations < 1 || (strcmp(format, "json") != 0 && strcmp(format, "snapshot") != 0)) {
+		usage(stderr);
+		return 1;
+	}
+
+	struct report report = {0};
+	if (snapshot_path) {
+		FILE *fp = fopen(snapshot_path, "rb");
+		int r = fp ? report_read_snapshot(&report, fp) : -1;
+		if (fp) {
+			fclose(fp);
+		}
+		if (r < 0) {
+			log_err("failed to read snapshot %s", snapshot_path);
+			return 1;
+		}
+	} else if (collect_repeatedly(&report, &opts, iterations) < 0) {
+		return 1;
+	}
+
+	int rc = 0;
+	if (strcmp(format, "snapshot") == 0) {
+		if (report_write_snapshot(&report, stdout) < 0) {
+			log_err("failed to write snapshot");
+			rc = 1;
+		}
+	} else {
+		print_json(&report, stdout);
+	}
+	report_free(&report);
+
+	return rc;
+}
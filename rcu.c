@@ -0,0 +1,89 @@
+// SPDX-FileCopyrightText: 2022-present Jakub Jirutka <jakub@jirutka.cz>
+// SPDX-License-Identifier: GPL-2.0-or-later
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#include "rcu.h"
+
+void rcu_init (struct rcu_cell *cell) {
+	atomic_init(&cell->current, NULL);
+	atomic_init(&cell->epoch, 0);
+	atomic_init(&cell->readers[0], 0);
+	atomic_init(&cell->readers[1], 0);
+	pthread_mutex_init(&cell->write_lock, NULL);
+}
+
+struct rcu_obj *rcu_acquire (struct rcu_cell *cell) {
+	unsigned epoch;
+
+	// Register in the current epoch; if the writer flipped it meanwhile, it
+	// may not wait for us, so retry in the new one.
+	for (;;) {
+		epoch = atomic_load(&cell->epoch) & 1;
+		atomic_fetch_add(&cell->readers[epoch], 1);
+		if ((atomic_load(&cell->epoch) & 1) == epoch) {
+			break;
+		}
+		atomic_fetch_sub(&cell->readers[epoch], 1);
+	}
+
+	// The writer holds its reference until all readers registered in this
+	// epoch leave, so obj cannot be freed before we increment refs.
+	struct rcu_obj *obj = atomic_load(&cell->current);
+	if (obj) {
+		atomic_fetch_add(&obj->refs, 1);
+	}
+	atomic_fetch_sub(&cell->readers[epoch], 1);
+
+	return obj;
+}
+
+void rcu_release (struct rcu_obj *obj) {
+	if (obj && atomic_fetch_sub(&obj->refs, 1) == 1) {
+		if (obj->destroy) {
+			obj->destroy(obj->data);
+		}
+		free(obj);
+	}
+}
+
+// Waits until every reader that could have loaded the old pointer has taken
+// its reference (or not). Must be called with write_lock held.
+static void synchronize (struct rcu_cell *cell) {
+	unsigned old_epoch = atomic_fetch_add(&cell->epoch, 1) & 1;
+
+	while (atomic_load(&cell->readers[old_epoch]) > 0) {
+		sched_yield();
+	}
+}
+
+int rcu_publish (struct rcu_cell *cell, void *data, void (*destroy)(void *data)) {
+	struct rcu_obj *obj = NULL;
+
+	if (data) {
+		if (!(obj = malloc(sizeof(*obj)))) {
+			return -1;
+		}
+		atomic_init(&obj->refs, 1);  // the cell's reference
+		obj->data = data;
+		obj->destroy = destroy;
+	}
+
+	pthread_mutex_lock(&cell->write_lock);
+	struct rcu_obj *old = atomic_exchange(&cell->current, obj);
+	synchronize(cell);
+	pthread_mutex_unlock(&cell->write_lock);
+
+	rcu_release(old);
+
+	return 0;
+}
+
+void rcu_destroy (struct rcu_cell *cell) {
+	rcu_publish(cell, NULL, NULL);
+	pthread_mutex_destroy(&cell->write_lock);
+}
@@ -0,0 +1,45 @@
+// SPDX-FileCopyrightText: 2022-present Jakub Jirutka <jakub@jirutka.cz>
+// SPDX-License-Identifier: GPL-2.0-or-later
+//
+// RCU-style publication of immutable objects. A writer publishes a new object
+// by swapping an atomic pointer; readers take a reference without locking and
+// without copying, and the object is destroyed when the last reference is
+// released. The short window between loading the pointer and taking
+// a reference is covered by a two-epoch reader counter that the writer waits
+// on (the grace period) before dropping its own reference to the old object.
+#ifndef RCU_H
+#define RCU_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+struct rcu_obj {
+	atomic_uint refs;
+	void *data;  // must not be modified once published
+	void (*destroy)(void *data);
+};
+
+struct rcu_cell {
+	_Atomic(struct rcu_obj *) current;
+	atomic_uint epoch;
+	atomic_long readers[2];
+	pthread_mutex_t write_lock;  // serializes writers only
+};
+
+void rcu_init (struct rcu_cell *cell);
+
+// Publishes data, taking ownership of it; destroy is called on it when the
+// last reference is released. Passing NULL data unpublishes the current
+// object. Returns -1 if out of memory (data is not destroyed then).
+int rcu_publish (struct rcu_cell *cell, void *data, void (*destroy)(void *data));
+
+// Returns a reference to the current object, or NULL if there's none.
+// It must be released with rcu_release(). Never blocks.
+struct rcu_obj *rcu_acquire (struct rcu_cell *cell);
+
+void rcu_release (struct rcu_obj *obj);
+
+// Unpublishes the current object and destroys the cell.
+void rcu_destroy (struct rcu_cell *cell);
+
+#endif
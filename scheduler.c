@@ -0,0 +1,110 @@
+// SPDX-FileCopyrightText: 2022-present Jakub Jirutka <jakub@jirutka.cz>
+// SPDX-License-Identifier: GPL-2.0-or-later
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+#include "core.h"
+#include "scheduler.h"
+
+static const char *LOCAL_DB_FILES[] = {
+	"/lib/apk/db/installed",
+	"/etc/apk/world",
+	"/etc/apk/repositories",
+};
+
+void sched_init (struct sched *s, double min_interval, double max_interval) {
+	*s = (struct sched) {
+		.min_interval = min_interval,
+		.max_interval = max_interval > min_interval ? max_interval : min_interval,
+		.interval = min_interval,
+		.period = min_interval,
+	};
+}
+
+void sched_set_intervals (struct sched *s, double min_interval, double max_interval) {
+	s->min_interval = min_interval;
+	s->max_interval = max_interval > min_interval ? max_interval : min_interval;
+	s->interval = min(max(s->interval, s->min_interval), s->max_interval);
+}
+
+bool sched_due (const struct sched *s, double now, uint64_t local_fingerprint) {
+	// Not adaptive, collectd already calls us every interval.
+	if ((s->max_interval <= s->min_interval && s->min_interval <= s->period) || s->last_refresh == 0) {
+		return true;
+	}
+	return local_fingerprint != s->local_fingerprint
+		|| now - s->last_refresh >= s->interval;
+}
+
+bool sched_postpone (struct sched *s, double now, bool pressured, double max_postpone) {
+	if (!pressured || (s->postponed_since > 0 && now - s->postponed_since >= max_postpone)) {
+		return false;
+	}
+	if (s->postponed_since == 0) {
+		s->postponed_since = now;
+	}
+	s->postponed_num++;
+
+	return true;
+}
+
+void sched_refreshed (struct sched *s, double now, uint64_t local_fingerprint,
+                      uint64_t index_fingerprint, uint64_t result_hash) {
+	bool changed = local_fingerprint != s->local_fingerprint
+		|| index_fingerprint != s->index_fingerprint
+		|| result_hash != s->result_hash;
+
+	if (changed) {
+		s->interval = s->min_interval;
+	} else {
+		s->interval = min(s->interval * 2, s->max_interval);
+	}
+	s->last_refresh = now;
+	s->local_fingerprint = local_fingerprint;
+	s->index_fingerprint = index_fingerprint;
+	s->result_hash = result_hash;
+	s->postponed_since = 0;
+}
+
+uint64_t local_db_fingerprint (const char *root_dir) {
+	uint64_t hash = FNV1A_INIT;
+
+	for (size_t i = 0; i < STATIC_ARRAY_SIZE(LOCAL_DB_FILES); i++) {
+		char path[4096];
+		snprintf(path, sizeof(path), "%s%s", root_dir ? root_dir : "", LOCAL_DB_FILES[i]);
+
+		struct stat st = {0};
+		if (stat(path, &st) < 0) {
+			continue;
+		}
+		uint64_t meta[] = {
+			st.st_ino, st.st_size, st.st_mtim.tv_sec, st.st_mtim.tv_nsec,
+		};
+		hash = fnv1a(meta, sizeof(meta), hash);
+	}
+	return hash;
+}
+
+static int read_avg10 (const char *resource, double *dest) {
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/pressure/%s", resource);
+
+	FILE *fp = fopen(path, "r");
+	if (!fp) {
+		return -1;
+	}
+	int rc = fscanf(fp, "some avg10=%lf", dest) == 1 ? 0 : -1;
+	fclose(fp);
+
+	return rc;
+}
+
+int read_pressure (struct pressure *dest) {
+	return read_avg10("cpu", &dest->cpu) < 0
+		|| read_avg10("memory", &dest->memory) < 0
+		|| read_avg10("io", &dest->io) < 0 ? -1 : 0;
+}
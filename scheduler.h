@@ -0,0 +1,66 @@
+// SPDX-FileCopyrightText: 2022-present Jakub Jirutka <jakub@jirutka.cz>
+// SPDX-License-Identifier: GPL-2.0-or-later
+//
+// Adaptive refresh scheduler. The read callback runs every min_interval, but
+// a full refresh (database open and solve) runs only when the effective
+// interval elapses or the local database has changed. The effective interval
+// doubles after every refresh that observed the same index fingerprint and
+// the same result, up to max_interval, and drops back to min_interval after
+// a repository update or a local install.
+//
+// A due refresh may be postponed while the system is under pressure (see
+// read_pressure()), so parsing the indexes and solving don't compete with
+// the workload when it's short of CPU, memory or I/O; the last result is
+// dispatched meanwhile.
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct sched {
+	double min_interval;  // seconds
+	double max_interval;  // seconds
+	double interval;  // current effective interval
+	double period;  // of the read callback, the min_interval given to sched_init()
+	double last_refresh;  // monotonic time of the last refresh, 0 if none
+	uint64_t local_fingerprint;  // of the local database files
+	uint64_t index_fingerprint;  // of the repository indexes
+	uint64_t result_hash;
+	double postponed_since;  // monotonic time of the first postponement, 0 if none
+	uint64_t postponed_num;  // postponements in total
+};
+
+// Pressure stall information: percentage of time in the last 10 seconds in
+// which some tasks were stalled on the resource ("some avg10").
+struct pressure {
+	double cpu;
+	double memory;
+	double io;
+};
+
+void sched_init (struct sched *s, double min_interval, double max_interval);
+
+// Changes the intervals while keeping the state, e.g. on reload of settings.
+void sched_set_intervals (struct sched *s, double min_interval, double max_interval);
+
+// Returns true if a full refresh should run now.
+bool sched_due (const struct sched *s, double now, uint64_t local_fingerprint);
+
+// Returns true if the refresh due now should be postponed because pressured
+// is true, unless it has been postponed for max_postpone seconds already.
+bool sched_postpone (struct sched *s, double now, bool pressured, double max_postpone);
+
+// Records a finished refresh and adjusts the effective interval.
+void sched_refreshed (struct sched *s, double now, uint64_t local_fingerprint,
+                      uint64_t index_fingerprint, uint64_t result_hash);
+
+// Computes a cheap fingerprint of the local apk database (installed, world
+// and repositories files) from their metadata, without reading them.
+uint64_t local_db_fingerprint (const char *root_dir);
+
+// Reads /proc/pressure/{cpu,memory,io}. Returns 0 on success, or -1 if PSI
+// isn't available (kernel older than 4.20 or built without CONFIG_PSI).
+int read_pressure (struct pressure *dest);
+
+#endif
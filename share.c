@@ -0,0 +1,342 @@
+// SPDX-FileCopyrightText: 2022-present Jakub Jirutka <jakub@jirutka.cz>
+// SPDX-License-Identifier: GPL-2.0-or-later
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "core.h"
+#include "share.h"
+
+#define REQUEST_MAX 4096
+#define IO_TIMEOUT_SEC 10
+
+// Address of a peer: 4 bytes for IPv4 (IPv4-mapped IPv6 included), 16 for IPv6.
+struct peer_addr {
+	unsigned char bytes[16];
+	size_t len;
+};
+
+struct share {
+	pthread_t thread;
+	bool started;
+	int listen_fd;
+	int stop_fds[2];  // self-pipe to wake up the thread on stop
+	struct peer_addr *peers;
+	size_t peers_num;
+	share_open_cb open_index;
+	void *arg;
+	atomic_uint_fast64_t served;
+};
+
+static bool peer_addr_from (struct peer_addr *dest, const struct sockaddr *sa) {
+	static const unsigned char v4_mapped[12] = { [10] = 0xff, [11] = 0xff };
+
+	if (sa->sa_family == AF_INET) {
+		memcpy(dest->bytes, &((const struct sockaddr_in *) sa)->sin_addr, 4);
+		dest->len = 4;
+	} else if (sa->sa_family == AF_INET6) {
+		const unsigned char *addr = ((const struct sockaddr_in6 *) sa)->sin6_addr.s6_addr;
+		if (memcmp(addr, v4_mapped, sizeof(v4_mapped)) == 0) {
+			memcpy(dest->bytes, addr + 12, 4);
+			dest->len = 4;
+		} else {
+			memcpy(dest->bytes, addr, 16);
+			dest->len = 16;
+		}
+	} else {
+		return false;
+	}
+	return true;
+}
+
+static bool is_peer (const struct share *s, const struct sockaddr *sa) {
+	struct peer_addr addr;
+
+	if (!peer_addr_from(&addr, sa)) {
+		return false;
+	}
+	for (size_t i = 0; i < s->peers_num; i++) {
+		if (s->peers[i].len == addr.len && memcmp(s->peers[i].bytes, addr.bytes, addr.len) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Resolves the host of the peer's base URL ("http://host:port", the host
+// may be an [IPv6] literal) and adds its addresses.
+static int add_peer (struct share *s, const char *url) {
+	const char *host = strstr(url, "://");
+	host = host ? host + 3 : url;
+
+	char name[256];
+	size_t len = *host == '[' ? strcspn(++host, "]") : strcspn(host, ":/");
+	if (len == 0 || len >= sizeof(name)) {
+		log_err("share: invalid peer URL: %s", url);
+		return -1;
+	}
+	memcpy(name, host, len);
+	name[len] = '\0';
+
+	struct addrinfo hints = { .ai_socktype = SOCK_STREAM };
+	struct addrinfo *res = NULL;
+	int r = getaddrinfo(name, NULL, &hints, &res);
+	if (r != 0) {
+		log_err("share: failed to resolve peer %s: %s", name, gai_strerror(r));
+		return -1;
+	}
+	for (struct addrinfo *ai = res; ai; ai = ai->ai_next) {
+		struct peer_addr *peers = realloc(s->peers, (s->peers_num + 1) * sizeof(*peers));
+		if (!peers) {
+			freeaddrinfo(res);
+			return -1;
+		}
+		s->peers = peers;
+		if (peer_addr_from(&peers[s->peers_num], ai->ai_addr)) {
+			s->peers_num++;
+		}
+	}
+	freeaddrinfo(res);
+
+	return 0;
+}
+
+static int send_all (int fd, const void *buf, size_t len) {
+	const char *p = buf;
+
+	while (len > 0) {
+		ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static void send_status (int fd, const char *status) {
+	char buf[256];
+	int len = snprintf(buf, sizeof(buf), "HTTP/1.0 %s\r\nContent-Length: 0\r\nConnection: close\r\n\r\n", status);
+
+	send_all(fd, buf, len);
+}
+
+static int send_file (int fd, int file_fd) {
+	struct stat st;
+	if (fstat(file_fd, &st) < 0) {
+		return -1;
+	}
+	char date[64];
+	struct tm tm;
+	strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", gmtime_r(&st.st_mtime, &tm));
+
+	char buf[65536];
+	int len = snprintf(buf, sizeof(buf), "HTTP/1.0 200 OK\r\n"
+	                   "Content-Type: application/octet-stream\r\n"
+	                   "Content-Length: %lld\r\n"
+	                   "Last-Modified: %s\r\n"
+	                   "Connection: close\r\n\r\n", (long long) st.st_size, date);
+	if (send_all(fd, buf, len) < 0) {
+		return -1;
+	}
+	ssize_t n;
+	while ((n = read(file_fd, buf, sizeof(buf))) > 0) {
+		if (send_all(fd, buf, n) < 0) {
+			return -1;
+		}
+	}
+	return n < 0 ? -1 : 0;
+}
+
+// Reads the request head and answers it; only GET is supported.
+static void handle (struct share *s, int fd) {
+	char req[REQUEST_MAX];
+	size_t len = 0;
+
+	while (len < sizeof(req) - 1) {
+		ssize_t n = recv(fd, req + len, sizeof(req) - 1 - len, 0);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return;
+		}
+		len += n;
+		req[len] = '\0';
+		if (strstr(req, "\r\n\r\n") || strstr(req, "\n\n")) {
+			break;
+		}
+	}
+	req[len] = '\0';
+
+	char method[8], path[REQUEST_MAX];
+	if (sscanf(req, "%7s %4095s HTTP/", method, path) != 2 || path[0] != '/') {
+		send_status(fd, "400 Bad Request");
+		return;
+	}
+	if (strcmp(method, "GET") != 0) {
+		send_status(fd, "405 Method Not Allowed");
+		return;
+	}
+	int file_fd = s->open_index(path + 1, s->arg);
+	if (file_fd < 0) {
+		send_status(fd, "404 Not Found");
+		return;
+	}
+	if (send_file(fd, file_fd) == 0) {
+		atomic_fetch_add(&s->served, 1);
+	}
+	close(file_fd);
+}
+
+static void *share_thread (void *arg) {
+	struct share *s = arg;
+
+	struct pollfd fds[] = {
+		{ .fd = s->listen_fd, .events = POLLIN },
+		{ .fd = s->stop_fds[0], .events = POLLIN },
+	};
+
+	while (true) {
+		int r = poll(fds, 2, -1);
+
+		if (r < 0 && errno != EINTR) {
+			log_err("share: poll failed: %s", strerror(errno));
+			break;
+		}
+		if (fds[1].revents) {
+			break;
+		}
+		if (r <= 0 || !(fds[0].revents & POLLIN)) {
+			continue;
+		}
+		struct sockaddr_storage addr;
+		socklen_t addr_len = sizeof(addr);
+		int fd = accept(s->listen_fd, (struct sockaddr *) &addr, &addr_len);
+		if (fd < 0) {
+			continue;
+		}
+		if (is_peer(s, (struct sockaddr *) &addr)) {
+			// A stalled peer mustn't block the others for long.
+			struct timeval timeout = { .tv_sec = IO_TIMEOUT_SEC };
+			setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+			setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+			handle(s, fd);
+		}
+		close(fd);
+	}
+	return NULL;
+}
+
+static int open_listener (const char *host, const char *port) {
+	struct addrinfo hints = { .ai_socktype = SOCK_STREAM, .ai_flags = AI_PASSIVE };
+	struct addrinfo *res = NULL;
+
+	int r = getaddrinfo(host, port, &hints, &res);
+	if (r != 0) {
+		log_err("share: failed to resolve %s: %s", host ? host : "*", gai_strerror(r));
+		return -1;
+	}
+	int fd = -1;
+	for (struct addrinfo *ai = res; ai && fd < 0; ai = ai->ai_next) {
+		if ((fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) < 0) {
+			continue;
+		}
+		int one = 1;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+		if (bind(fd, ai->ai_addr, ai->ai_addrlen) < 0 || listen(fd, 16) < 0) {
+			close(fd);
+			fd = -1;
+		}
+	}
+	freeaddrinfo(res);
+
+	if (fd < 0) {
+		log_err("share: failed to listen on %s port %s: %s", host ? host : "*", port, strerror(errno));
+	}
+	return fd;
+}
+
+int share_start (struct share **dest, const char *host, const char *port,
+                 char *const *peers, size_t peers_num, share_open_cb open_index, void *arg) {
+	struct share *s = calloc(1, sizeof(*s));
+	if (!s) {
+		return -1;
+	}
+	*s = (struct share) {
+		.listen_fd = -1,
+		.stop_fds = { -1, -1 },
+		.open_index = open_index,
+		.arg = arg,
+	};
+	atomic_init(&s->served, 0);
+
+	for (size_t i = 0; i < peers_num; i++) {
+		if (add_peer(s, peers[i]) < 0) {
+			goto fail;
+		}
+	}
+	if ((s->listen_fd = open_listener(host, port)) < 0) {
+		goto fail;
+	}
+	if (pipe(s->stop_fds) < 0) {
+		log_err("share: %s", strerror(errno));
+		goto fail;
+	}
+	int err = pthread_create(&s->thread, NULL, share_thread, s);
+	if (err != 0) {
+		log_err("share: failed to start thread: %s", strerror(err));
+		goto fail;
+	}
+	s->started = true;
+	*dest = s;
+
+	return 0;
+fail:
+	share_stop(s);
+
+	return -1;
+}
+
+uint64_t share_served (struct share *s) {
+	return atomic_load(&s->served);
+}
+
+void share_stop (struct share *s) {
+	if (!s) {
+		return;
+	}
+	if (s->started && write(s->stop_fds[1], "", 1) == 1) {
+		pthread_join(s->thread, NULL);
+	}
+	for (size_t i = 0; i < 2; i++) {
+		if (s->stop_fds[i] >= 0) {
+			close(s->stop_fds[i]);
+		}
+	}
+	if (s->listen_fd >= 0) {
+		close(s->listen_fd);
+	}
+	free(s->peers);
+	free(s);
+}
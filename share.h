@@ -0,0 +1,38 @@
+// SPDX-FileCopyrightText: 2022-present Jakub Jirutka <jakub@jirutka.cz>
+// SPDX-License-Identifier: GPL-2.0-or-later
+//
+// Sharing of the cached indexes with peers on the local network. A thread
+// serves them over plain HTTP/1.0, one request at a time, at the path of
+// their URL without the scheme, e.g.
+// GET /dl-cdn.alpinelinux.org/alpine/v3.20/main/x86_64/APKINDEX.tar.gz.
+// That's what libapk of a peer requests when its repository URL has the
+// scheme replaced with our base URL (see core_collect()). The indexes are
+// signed, so neither side has to trust the other; libapk of the peer
+// verifies them as if they came from the mirror. Only connections from the
+// addresses of the configured peers are accepted.
+#ifndef SHARE_H
+#define SHARE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct share;
+
+// Returns a file descriptor of the index at path (without the leading
+// slash), or -1 if there's no such index. Called from the share thread.
+typedef int (*share_open_cb)(const char *path, void *arg);
+
+// Listens on host (NULL for any address) and port and starts the server
+// thread. Connections are accepted only from the hosts of the peers' base
+// URLs (e.g. "http://10.0.0.2:8091"). Returns 0 on success, or -1 on error
+// (the error is logged).
+int share_start (struct share **dest, const char *host, const char *port,
+                 char *const *peers, size_t peers_num, share_open_cb open_index, void *arg);
+
+// Returns the number of indexes served since the start.
+uint64_t share_served (struct share *share);
+
+// Stops the server thread and frees the share.
+void share_stop (struct share *share);
+
+#endif
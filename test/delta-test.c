@@ -0,0 +1,137 @@
+// SPDX-FileCopyrightText: 2022-present Jakub Jirutka <jakub@jirutka.cz>
+// SPDX-License-Identifier: GPL-2.0-or-later
+//
+// Test of digest_compare() (delta.c): builds digests of small indexes the way
+// the backend does and checks which changes are counted and which of them
+// are relevant to the installed packages (make check-delta).
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../delta.h"
+
+// Two names whose 32-bit name hashes in the digest entries collide.
+#define COLLIDING_A "pkg-25476"
+#define COLLIDING_B "pkg-37012"
+
+struct pkg {
+	const char *name;
+	const char *version;
+};
+
+static int failures = 0;
+
+// Builds a finished digest of the index pkgs with the installed packages
+// installed (also in the index), like backend_index_digest() does.
+static int build (struct index_digest *dest, const char *const *installed, const struct pkg *pkgs) {
+	*dest = (struct index_digest) {0};
+
+	for (size_t i = 0; installed[i]; i++) {
+		digest_add_local(dest, installed[i], strlen(installed[i]));
+
+		if (digest_add_closure(dest, installed[i], strlen(installed[i])) < 0) {
+			return -1;
+		}
+	}
+	for (size_t i = 0; pkgs[i].name; i++) {
+		const char *name = pkgs[i].name, *version = pkgs[i].version;
+		bool relevant = digest_in_closure(dest, name, strlen(name));
+
+		if (digest_add_entry(dest, name, strlen(name), version, strlen(version),
+		                     version, strlen(version), relevant) < 0) {
+			return -1;
+		}
+	}
+	digest_finish(dest);
+
+	return 0;
+}
+
+static void check (const char *title, const char *const *old_installed, const struct pkg *old_pkgs,
+                   const char *const *new_installed, const struct pkg *new_pkgs,
+                   bool exp_comparable, size_t exp_changed, size_t exp_relevant) {
+	struct index_digest old, new;
+	struct index_delta delta;
+
+	if (build(&old, old_installed, old_pkgs) < 0 || build(&new, new_installed, new_pkgs) < 0) {
+		fprintf(stderr, "%s: out of memory\n", title);
+		failures++;
+		return;
+	}
+	bool comparable = digest_compare(&old, &new, &delta);
+
+	if (comparable != exp_comparable || delta.changed != exp_changed || delta.relevant != exp_relevant) {
+		fprintf(stderr, "%s: expected comparable=%d changed=%zu relevant=%zu, got %d %zu %zu\n",
+		        title, exp_comparable, exp_changed, exp_relevant, comparable, delta.changed, delta.relevant);
+		failures++;
+	}
+	digest_free(&old);
+	digest_free(&new);
+}
+
+int main (void) {
+	const char *const installed[] = { "musl", "busybox", NULL };
+	const struct pkg base[] = {
+		{ "musl", "1.2.5-r0" },
+		{ "busybox", "1.36.1-r29" },
+		{ "curl", "8.9.0-r0" },
+		{ "nginx", "1.26.2-r0" },
+		{ NULL, NULL },
+	};
+
+	check("no change", installed, base, installed, base, true, 0, 0);
+
+	check("irrelevant change", installed, base, installed, (const struct pkg[]) {
+		{ "musl", "1.2.5-r0" },
+		{ "busybox", "1.36.1-r29" },
+		{ "curl", "8.9.1-r0" },
+		{ "nginx", "1.26.2-r0" },
+		{ NULL, NULL },
+	}, true, 1, 0);
+
+	check("relevant change", installed, base, installed, (const struct pkg[]) {
+		{ "musl", "1.2.5-r1" },
+		{ "busybox", "1.36.1-r29" },
+		{ "curl", "8.9.0-r0" },
+		{ "nginx", "1.26.2-r0" },
+		{ NULL, NULL },
+	}, true, 1, 1);
+
+	check("irrelevant addition", installed, base, installed, (const struct pkg[]) {
+		{ "musl", "1.2.5-r0" },
+		{ "busybox", "1.36.1-r29" },
+		{ "curl", "8.9.0-r0" },
+		{ "nginx", "1.26.2-r0" },
+		{ "nginx", "1.27.1-r0" },
+		{ NULL, NULL },
+	}, true, 1, 0);
+
+	check("removal", installed, base, installed, (const struct pkg[]) {
+		{ "musl", "1.2.5-r0" },
+		{ "curl", "8.9.0-r0" },
+		{ NULL, NULL },
+	}, true, 2, 1);
+
+	check("changed installed packages", installed, base, (const char *const[]) { "musl", NULL }, base, false, 0, 0);
+
+	// Runs of colliding names are merged, so a change of the package that
+	// isn't installed must look relevant, never the other way round.
+	const char *const colliding_installed[] = { COLLIDING_A, NULL };
+	const struct pkg colliding[] = {
+		{ COLLIDING_A, "1.0-r0" },
+		{ COLLIDING_B, "1.0-r0" },
+		{ NULL, NULL },
+	};
+	check("name hash collision", colliding_installed, colliding, colliding_installed, (const struct pkg[]) {
+		{ COLLIDING_A, "1.0-r0" },
+		{ COLLIDING_B, "1.1-r0" },
+		{ NULL, NULL },
+	}, true, 1, 1);
+
+	printf("failures: %d\n", failures);
+
+	return failures == 0 ? 0 : 1;
+}
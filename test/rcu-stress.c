@@ -0,0 +1,106 @@
+// SPDX-FileCopyrightText: 2022-present Jakub Jirutka <jakub@jirutka.cz>
+// SPDX-License-Identifier: GPL-2.0-or-later
+//
+// Stress test of rcu.c: reader threads keep acquiring the current object and
+// verifying its contents while a writer publishes new ones. Meant to be run
+// under ThreadSanitizer (make check-rcu), which reports any data race or
+// use-after-free; the test itself checks that no object is seen torn and
+// that every published object is destroyed exactly once.
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../rcu.h"
+
+#define READERS 8
+#define GENERATIONS 20000
+#define VALUES 64
+
+struct payload {
+	uint64_t generation;
+	uint64_t values[VALUES];  // all equal to generation
+};
+
+static struct rcu_cell cell;
+static atomic_bool done = false;
+static atomic_long destroyed = 0;
+static atomic_long failures = 0;
+
+static void payload_destroy (void *data) {
+	struct payload *p = data;
+	memset(p, 0xAA, sizeof(*p));  // make a use-after-free visible
+	free(p);
+	atomic_fetch_add(&destroyed, 1);
+}
+
+static void *reader_run (void *arg) {
+	long *reads = arg;
+	uint64_t last_generation = 0;
+
+	while (!atomic_load(&done)) {
+		struct rcu_obj *obj = rcu_acquire(&cell);
+		if (!obj) {
+			continue;
+		}
+		const struct payload *p = obj->data;
+		for (int i = 0; i < VALUES; i++) {
+			if (p->values[i] != p->generation) {
+				atomic_fetch_add(&failures, 1);
+				break;
+			}
+		}
+		// A reader must never observe an older object than it has already seen.
+		if (p->generation < last_generation) {
+			atomic_fetch_add(&failures, 1);
+		}
+		last_generation = p->generation;
+		rcu_release(obj);
+		(*reads)++;
+	}
+	return NULL;
+}
+
+int main (void) {
+	pthread_t readers[READERS];
+	long reads[READERS] = {0};
+
+	rcu_init(&cell);
+
+	for (int i = 0; i < READERS; i++) {
+		if (pthread_create(&readers[i], NULL, reader_run, &reads[i]) != 0) {
+			fprintf(stderr, "failed to create reader thread\n");
+			return 1;
+		}
+	}
+	for (uint64_t gen = 1; gen <= GENERATIONS; gen++) {
+		struct payload *p = malloc(sizeof(*p));
+		if (!p) {
+			return 1;
+		}
+		p->generation = gen;
+		for (int i = 0; i < VALUES; i++) {
+			p->values[i] = gen;
+		}
+		if (rcu_publish(&cell, p, payload_destroy) < 0) {
+			return 1;
+		}
+	}
+	atomic_store(&done, true);
+
+	long total_reads = 0;
+	for (int i = 0; i < READERS; i++) {
+		pthread_join(readers[i], NULL);
+		total_reads += reads[i];
+	}
+	rcu_destroy(&cell);
+
+	printf("generations: %d, reads: %ld, destroyed: %ld, failures: %ld\n",
+	       GENERATIONS, total_reads, atomic_load(&destroyed), atomic_load(&failures));
+
+	return atomic_load(&failures) == 0 && atomic_load(&destroyed) == GENERATIONS ? 0 : 1;
+}
@@ -0,0 +1,147 @@
+// SPDX-FileCopyrightText: 2022-present Jakub Jirutka <jakub@jirutka.cz>
+// SPDX-License-Identifier: GPL-2.0-or-later
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "core.h"
+#include "trigger.h"
+
+#define COMMAND_MAX 64
+
+struct trigger {
+	pthread_t thread;
+	bool started;
+	int fifo_fd;
+	int stop_fds[2];  // self-pipe to wake up the thread on stop
+	int debounce_ms;
+	trigger_cb callback;
+	void *arg;
+};
+
+// Reads everything available and keeps the last non-empty line in command.
+static void drain (int fd, char *command) {
+	char buf[512];
+	ssize_t n;
+
+	while ((n = read(fd, buf, sizeof(buf) - 1)) > 0) {
+		buf[n] = '\0';
+
+		char *saveptr = NULL;
+		for (char *line = strtok_r(buf, "\r\n", &saveptr); line; line = strtok_r(NULL, "\r\n", &saveptr)) {
+			strncpy(command, line, COMMAND_MAX - 1);
+			command[COMMAND_MAX - 1] = '\0';
+		}
+	}
+}
+
+static void *trigger_thread (void *arg) {
+	struct trigger *t = arg;
+	char command[COMMAND_MAX] = "";
+	bool pending = false;
+
+	struct pollfd fds[] = {
+		{ .fd = t->fifo_fd, .events = POLLIN },
+		{ .fd = t->stop_fds[0], .events = POLLIN },
+	};
+
+	while (true) {
+		// While a trigger is pending, wait only for the debounce period; every
+		// new write restarts it, so a burst of transactions yields one run.
+		int r = poll(fds, 2, pending ? t->debounce_ms : -1);
+
+		if (r < 0 && errno != EINTR) {
+			log_err("trigger: poll failed: %s", strerror(errno));
+			break;
+		}
+		if (fds[1].revents) {
+			break;
+		}
+		if (r > 0 && fds[0].revents & POLLIN) {
+			drain(t->fifo_fd, command);
+			pending = true;
+
+		} else if (r == 0 && pending) {
+			pending = false;
+			t->callback(command[0] ? command : "refresh", t->arg);
+			command[0] = '\0';
+		}
+	}
+	return NULL;
+}
+
+int trigger_start (struct trigger **dest, const char *path, double debounce_sec,
+                   trigger_cb callback, void *arg) {
+	int err = 0;
+	struct trigger *t = calloc(1, sizeof(*t));
+	if (!t) {
+		return -1;
+	}
+	*t = (struct trigger) {
+		.fifo_fd = -1,
+		.stop_fds = { -1, -1 },
+		.debounce_ms = debounce_sec * 1000,
+		.callback = callback,
+		.arg = arg,
+	};
+
+	if (mkfifo(path, 0620) < 0 && errno != EEXIST) {
+		goto fail;
+	}
+	struct stat st;
+	if (stat(path, &st) < 0) {
+		goto fail;
+	}
+	if (!S_ISFIFO(st.st_mode)) {
+		errno = EEXIST;
+		goto fail;
+	}
+	// Opened for writing too, so that we never see EOF when writers close it
+	// and writers never block while we're running.
+	if ((t->fifo_fd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC)) < 0) {
+		goto fail;
+	}
+	if (pipe(t->stop_fds) < 0) {
+		goto fail;
+	}
+	if ((err = pthread_create(&t->thread, NULL, trigger_thread, t)) != 0) {
+		errno = err;
+		goto fail;
+	}
+	t->started = true;
+	*dest = t;
+
+	return 0;
+fail:
+	err = errno;
+	trigger_stop(t);
+	errno = err;
+
+	return -1;
+}
+
+void trigger_stop (struct trigger *t) {
+	if (!t) {
+		return;
+	}
+	if (t->started && write(t->stop_fds[1], "", 1) == 1) {
+		pthread_join(t->thread, NULL);
+	}
+	for (size_t i = 0; i < 2; i++) {
+		if (t->stop_fds[i] >= 0) {
+			close(t->stop_fds[i]);
+		}
+	}
+	if (t->fifo_fd >= 0) {
+		close(t->fifo_fd);
+	}
+	free(t);
+}
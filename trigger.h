@@ -0,0 +1,23 @@
+// SPDX-FileCopyrightText: 2022-present Jakub Jirutka <jakub@jirutka.cz>
+// SPDX-License-Identifier: GPL-2.0-or-later
+//
+// Trigger channel: a thread listening on a FIFO (written by the apk commit
+// hook, see commit-hook.sh) that runs a callback once a burst of writes has
+// settled for the debounce period.
+#ifndef TRIGGER_H
+#define TRIGGER_H
+
+struct trigger;
+
+typedef void (*trigger_cb)(const char *command, void *arg);
+
+// Creates the FIFO at path (if it doesn't exist) and starts the listener
+// thread. The callback gets the last line written into the FIFO (e.g.
+// "refresh"). Returns 0 on success, or -1 on error (errno is set).
+int trigger_start (struct trigger **dest, const char *path, double debounce_sec,
+                   trigger_cb callback, void *arg);
+
+// Stops the listener thread and frees the trigger.
+void trigger_stop (struct trigger *trigger);
+
+#endif